@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "bufio.h"
+#include "filerw.h"
+#include "adaptive.h"
+
+/* Index of the root, the highest numbered node */
+#define ADAPTIVE_ROOT (ADAPTIVE_NODES - 1)
+
+/* Reads bits one at a time from a buffered reader, most significant bit
+ * of each byte first */
+typedef struct BitSource {
+	BufReader *in;
+	/* The byte being read */
+	unsigned int byte;
+	/* Number of bits of byte not read yet */
+	int nbits;
+} BitSource;
+
+/* Returns the next bit, or -1 once the input has run out */
+static int getBit(BitSource *br) {
+	int next;
+	if (br->nbits == 0) {
+		next = readerGetc(br->in);
+		if (next == -1) {
+			return -1;
+		}
+		br->byte = next;
+		br->nbits = 8;
+	}
+	br->nbits -= 1;
+	return (br->byte >> br->nbits) & 1;
+}
+
+/* Sets up a tree that is only the NYT leaf */
+void initAdaptive(AdaptiveModel *model) {
+	int i;
+	for (i = 0; i < ADAPTIVE_SYMBOLS; i++) {
+		model->leaf[i] = -1;
+	}
+	model->nyt = ADAPTIVE_ROOT;
+	model->nodes[ADAPTIVE_ROOT].weight = 0;
+	model->nodes[ADAPTIVE_ROOT].parent = -1;
+	model->nodes[ADAPTIVE_ROOT].left = -1;
+	model->nodes[ADAPTIVE_ROOT].right = -1;
+	model->nodes[ADAPTIVE_ROOT].symbol = -1;
+}
+
+/* Points whatever now sits at index i back at i: its children's parent
+ * links, or the leaf index of its symbol */
+static void relink(AdaptiveModel *model, int i) {
+	AdaptiveNode *node = &model->nodes[i];
+	if (node->left != -1) {
+		model->nodes[node->left].parent = i;
+		model->nodes[node->right].parent = i;
+	}
+	else if (node->symbol != -1) {
+		model->leaf[node->symbol] = i;
+	}
+	else {
+		model->nyt = i;
+	}
+}
+
+/* Swaps the subtrees at two indexes. Each index keeps its parent, so
+ * the subtrees trade places in the tree and in the numbering. */
+static void swapNodes(AdaptiveModel *model, int a, int b) {
+	AdaptiveNode temp = model->nodes[a];
+	int parent_a = model->nodes[a].parent;
+	int parent_b = model->nodes[b].parent;
+
+	model->nodes[a] = model->nodes[b];
+	model->nodes[a].parent = parent_a;
+	model->nodes[b] = temp;
+	model->nodes[b].parent = parent_b;
+	relink(model, a);
+	relink(model, b);
+}
+
+/* Counts one more occurrence of a symbol, keeping the sibling property
+ * (FGK). A symbol seen for the first time splits the NYT leaf into a new
+ * NYT leaf and a leaf for the symbol. Then, walking from the symbol's
+ * leaf to the root, each node is first swapped with the highest
+ * numbered node of the same weight and then has its weight bumped. Only
+ * the nodes on that path are touched. */
+void updateAdaptive(AdaptiveModel *model, int symbol) {
+	AdaptiveNode *nodes = model->nodes;
+	int q = model->leaf[symbol];
+	int old_nyt, leader;
+
+	if (q == -1) {
+		old_nyt = model->nyt;
+		q = old_nyt - 1;
+		model->nyt = old_nyt - 2;
+		nodes[old_nyt].left = model->nyt;
+		nodes[old_nyt].right = q;
+
+		nodes[model->nyt].weight = 0;
+		nodes[model->nyt].parent = old_nyt;
+		nodes[model->nyt].left = -1;
+		nodes[model->nyt].right = -1;
+		nodes[model->nyt].symbol = -1;
+
+		nodes[q].weight = 0;
+		nodes[q].parent = old_nyt;
+		nodes[q].left = -1;
+		nodes[q].right = -1;
+		nodes[q].symbol = symbol;
+		model->leaf[symbol] = q;
+	}
+	while (q != -1) {
+		/* Nodes of the same weight are next to each other in the
+		 * numbering, so the block leader is found by looking up */
+		leader = q;
+		while (leader < ADAPTIVE_ROOT
+				&& nodes[leader + 1].weight == nodes[q].weight) {
+			leader += 1;
+		}
+		if (leader != q && leader != nodes[q].parent) {
+			swapNodes(model, q, leader);
+			q = leader;
+		}
+		nodes[q].weight += 1;
+		q = nodes[q].parent;
+	}
+}
+
+/* Writes the path from the root to a node, 0 for left and 1 for right */
+static void putPath(AdaptiveModel *model, BitWriter *bw, int node) {
+	/* The path is found from the node up, so it is kept to be written
+	 * in reverse */
+	uint8_t path[ADAPTIVE_NODES];
+	int n = 0, len = 0;
+	int parent;
+	uint64_t bits = 0;
+
+	while ((parent = model->nodes[node].parent) != -1) {
+		path[n++] = model->nodes[parent].right == node;
+		node = parent;
+	}
+	while (n > 0) {
+		bits = (bits << 1) | path[--n];
+		len += 1;
+		if (len == 32) {
+			putBits(bw, bits, len);
+			bits = 0;
+			len = 0;
+		}
+	}
+	putBits(bw, bits, len);
+}
+
+/* Writes the code of a symbol under the current tree. A symbol not seen
+ * yet is sent as the code of the NYT leaf followed by the symbol
+ * itself in ADAPTIVE_RAW_BITS bits. */
+static void putSymbol(AdaptiveModel *model, BitWriter *bw, int symbol) {
+	if (model->leaf[symbol] != -1) {
+		putPath(model, bw, model->leaf[symbol]);
+	}
+	else {
+		putPath(model, bw, model->nyt);
+		putBits(bw, symbol, ADAPTIVE_RAW_BITS);
+	}
+}
+
+/* Compresses the input in a single pass with adaptive huffman codes.
+ * The encoder and decoder start from the same empty tree and update it
+ * after every symbol, so no frequencies or code lengths are sent. The
+ * output is the magic bytes and version (VERSION_ADAPTIVE) followed by
+ * the codes, ending with the code for ADAPTIVE_EOF.
+ *
+ * Parameters:
+ *  in - A buffered reader for the input file
+ *  out - A buffered writer for the output file
+ */
+void adaptiveEncode(BufReader *in, BufWriter *out) {
+	AdaptiveModel *model = malloc(sizeof(AdaptiveModel));
+	BitWriter bw;
+	int c;
+
+	if (!model) {
+		perror("malloc AdaptiveModel");
+		exit(EXIT_FAILURE);
+	}
+	initAdaptive(model);
+	writerWrite(out, HUFF_MAGIC, MAGIC_LEN);
+	writerPutc(out, VERSION_ADAPTIVE);
+	initBitWriter(&bw, out);
+	while (1) {
+		if (in->pos == in->len) {
+			/* Pass on everything coded so far before waiting
+			 * for more input */
+			if (!in->fixed) {
+				writerFlush(out);
+			}
+			if (readerFill(in) == 0) {
+				break;
+			}
+		}
+		c = in->buf[in->pos++];
+		putSymbol(model, &bw, c);
+		updateAdaptive(model, c);
+	}
+	putSymbol(model, &bw, ADAPTIVE_EOF);
+	flushBits(&bw);
+	free(model);
+}
+
+/* Decompresses a stream written by adaptiveEncode by walking the same
+ * tree bit by bit and updating it after every symbol.
+ *
+ * Parameters:
+ *  in - A buffered reader positioned just after the version byte
+ *  out - A buffered writer for the output file
+ */
+void adaptiveDecode(BufReader *in, BufWriter *out) {
+	AdaptiveModel *model = malloc(sizeof(AdaptiveModel));
+	BitSource br;
+	int node, bit, i;
+	int symbol;
+
+	if (!model) {
+		perror("malloc AdaptiveModel");
+		exit(EXIT_FAILURE);
+	}
+	initAdaptive(model);
+	br.in = in;
+	br.nbits = 0;
+	while (1) {
+		/* Walk down from the root to a leaf. The root is the NYT leaf
+		 * itself until the first symbol, and then no bit is read. */
+		node = ADAPTIVE_ROOT;
+		bit = 0;
+		while (model->nodes[node].left != -1) {
+			if ((bit = getBit(&br)) == -1) {
+				break;
+			}
+			node = bit ? model->nodes[node].right :
+					model->nodes[node].left;
+		}
+		symbol = model->nodes[node].symbol;
+		/* New symbol, sent as is after the NYT code */
+		if (bit != -1 && node == model->nyt) {
+			symbol = 0;
+			for (i = 0; i < ADAPTIVE_RAW_BITS && bit != -1; i++) {
+				bit = getBit(&br);
+				symbol = (symbol << 1) | bit;
+			}
+			if (bit != -1 && symbol == ADAPTIVE_EOF) {
+				break;
+			}
+			if (bit != -1 && (symbol > ADAPTIVE_EOF ||
+					model->leaf[symbol] != -1)) {
+				bit = -1;
+			}
+		}
+		if (bit == -1) {
+			fprintf(stderr, "truncated or invalid adaptive stream\n");
+			exit(EXIT_FAILURE);
+		}
+		writerPutc(out, symbol);
+		updateAdaptive(model, symbol);
+	}
+	free(model);
+}
@@ -0,0 +1,46 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifndef ADAPTIVEH
+#define ADAPTIVEH
+#include "bufio.h"
+
+/* Symbols of the adaptive code: the 256 byte values and an end of
+ * stream symbol */
+#define ADAPTIVE_SYMBOLS 257
+#define ADAPTIVE_EOF 256
+/* Bits used to send a symbol the first time it is seen */
+#define ADAPTIVE_RAW_BITS 9
+/* Most nodes the adaptive tree can have */
+#define ADAPTIVE_NODES (2 * ADAPTIVE_SYMBOLS - 1)
+
+/* AdaptiveNode: A node of the adaptive huffman tree. Nodes live in an
+ * array ordered by their FGK node number, so a node's index is its
+ * number and weights never decrease going up the array. */
+typedef struct AdaptiveNode {
+	/* Number of times the symbols below the node have been seen */
+	uint64_t weight;
+	/* Index of the parent, -1 for the root */
+	int parent;
+	/* Indexes of the children, -1 for a leaf */
+	int left;
+	int right;
+	/* Symbol of a leaf, -1 for the NYT (not yet transmitted) leaf */
+	int symbol;
+} AdaptiveNode;
+
+/* AdaptiveModel: The adaptive huffman tree shared in lockstep by the
+ * encoder and the decoder */
+typedef struct AdaptiveModel {
+	AdaptiveNode nodes[ADAPTIVE_NODES];
+	/* Index of the leaf of each symbol, -1 if not seen yet */
+	int leaf[ADAPTIVE_SYMBOLS];
+	/* Index of the NYT leaf */
+	int nyt;
+} AdaptiveModel;
+
+void initAdaptive(AdaptiveModel *);
+void updateAdaptive(AdaptiveModel *, int);
+void adaptiveEncode(BufReader *, BufWriter *);
+void adaptiveDecode(BufReader *, BufWriter *);
+#endif
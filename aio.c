@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "bufio.h"
+#include "aio.h"
+
+/* io_uring is used when the kernel headers have it, unless the build
+ * asks for the thread with -DNO_IO_URING */
+#if defined(__linux__) && !defined(NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define HAVE_IO_URING
+#endif
+#endif
+#endif
+
+/* Largest read or write handed to the kernel at once */
+#define AIO_MAX_CHUNK (1 << 30)
+
+#ifdef HAVE_IO_URING
+/* Sets up an io_uring with room for one operation and maps its rings.
+ * Returns -1 if the kernel has no io_uring, has it turned off, or
+ * can't read and write at the file position, which pipes need. */
+static int setupRing(AsyncIo *aio) {
+	struct io_uring_params params;
+	uint8_t *sq;
+	uint8_t *cq;
+
+	memset(&params, 0, sizeof(params));
+	aio->ring = syscall(__NR_io_uring_setup, 1, &params);
+	if (aio->ring == -1) {
+		return -1;
+	}
+	if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+		close(aio->ring);
+		aio->ring = -1;
+		return -1;
+	}
+	aio->sq_map_size = params.sq_off.array +
+			params.sq_entries * sizeof(unsigned);
+	aio->cq_map_size = params.cq_off.cqes +
+			params.cq_entries * sizeof(struct io_uring_cqe);
+	aio->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	aio->sq_map = mmap(NULL, aio->sq_map_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, aio->ring,
+			IORING_OFF_SQ_RING);
+	aio->cq_map = mmap(NULL, aio->cq_map_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, aio->ring,
+			IORING_OFF_CQ_RING);
+	aio->sqes = mmap(NULL, aio->sqes_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, aio->ring, IORING_OFF_SQES);
+	if (aio->sq_map == MAP_FAILED || aio->cq_map == MAP_FAILED ||
+			aio->sqes == MAP_FAILED) {
+		if (aio->sq_map != MAP_FAILED) {
+			munmap(aio->sq_map, aio->sq_map_size);
+		}
+		if (aio->cq_map != MAP_FAILED) {
+			munmap(aio->cq_map, aio->cq_map_size);
+		}
+		if (aio->sqes != MAP_FAILED) {
+			munmap(aio->sqes, aio->sqes_size);
+		}
+		close(aio->ring);
+		aio->ring = -1;
+		return -1;
+	}
+	sq = aio->sq_map;
+	cq = aio->cq_map;
+	aio->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+	aio->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+	aio->sq_array = (unsigned *)(sq + params.sq_off.array);
+	aio->cq_head = (unsigned *)(cq + params.cq_off.head);
+	aio->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+	aio->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+	aio->cqes = cq + params.cq_off.cqes;
+	return 0;
+}
+
+/* Queues the operation in the ring and tells the kernel about it
+ * without waiting for it */
+static void ringSubmit(AsyncIo *aio) {
+	unsigned tail = *aio->sq_tail;
+	unsigned slot = tail & *aio->sq_mask;
+	struct io_uring_sqe *sqe = (struct io_uring_sqe *)aio->sqes + slot;
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = aio->op == AIO_READ ? IORING_OP_READ : IORING_OP_WRITE;
+	sqe->fd = aio->fd;
+	sqe->addr = (uintptr_t)aio->data;
+	sqe->len = aio->n < AIO_MAX_CHUNK ? aio->n : AIO_MAX_CHUNK;
+	/* At the file position, and moving it, like read and write */
+	sqe->off = (uint64_t)-1;
+	aio->sq_array[slot] = slot;
+	__atomic_store_n(aio->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	while (syscall(__NR_io_uring_enter, aio->ring, 1, 0, 0, NULL, 0)
+			== -1) {
+		if (errno != EINTR) {
+			perror("io_uring_enter");
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+/* Waits for the operation in the ring to complete. Returns what read
+ * or write would have, with a negative errno on error. */
+static ssize_t ringComplete(AsyncIo *aio) {
+	unsigned head = *aio->cq_head;
+	struct io_uring_cqe *cqe;
+	ssize_t res;
+
+	while (head == __atomic_load_n(aio->cq_tail, __ATOMIC_ACQUIRE)) {
+		if (syscall(__NR_io_uring_enter, aio->ring, 0, 1,
+				IORING_ENTER_GETEVENTS, NULL, 0) == -1
+				&& errno != EINTR) {
+			perror("io_uring_enter");
+			exit(EXIT_FAILURE);
+		}
+	}
+	cqe = (struct io_uring_cqe *)aio->cqes + (head & *aio->cq_mask);
+	res = cqe->res;
+	__atomic_store_n(aio->cq_head, head + 1, __ATOMIC_RELEASE);
+	return res;
+}
+#endif
+
+/* Takes the result of one read or write call for the operation. A
+ * write that moved only part of its bytes is left with the rest.
+ * Returns 1 once the operation is done, 0 if it needs another call. */
+static int finishCall(AsyncIo *aio, ssize_t status) {
+	if (aio->op == AIO_READ) {
+		countCall(&io_counters.read_calls, &io_counters.bytes_read,
+				status);
+	}
+	else {
+		countCall(&io_counters.write_calls,
+				&io_counters.bytes_written, status);
+	}
+	if (status == -1) {
+		/* Interrupted before anything was moved, try again */
+		if (errno == EINTR || errno == EAGAIN) {
+			return 0;
+		}
+		perror(aio->op == AIO_READ ? "error reading file" :
+				"error writing file");
+		exit(EXIT_FAILURE);
+	}
+	if (aio->op == AIO_READ) {
+		aio->result = status;
+		return 1;
+	}
+	aio->data += status;
+	aio->n -= status;
+	return aio->n == 0;
+}
+
+/* Thread function running each submitted operation with plain read
+ * and write calls until it is told to stop */
+static void *ioThread(void *arg) {
+	AsyncIo *aio = arg;
+	size_t chunk;
+	ssize_t status;
+
+	pthread_mutex_lock(&aio->lock);
+	while (1) {
+		while (!aio->pending && !aio->stop) {
+			pthread_cond_wait(&aio->submitted, &aio->lock);
+		}
+		if (!aio->pending) {
+			break;
+		}
+		pthread_mutex_unlock(&aio->lock);
+		do {
+			chunk = aio->n < AIO_MAX_CHUNK ? aio->n :
+					AIO_MAX_CHUNK;
+			status = aio->op == AIO_READ ?
+				read(aio->fd, aio->data, chunk) :
+				write(aio->fd, aio->data, chunk);
+		} while (!finishCall(aio, status));
+		pthread_mutex_lock(&aio->lock);
+		aio->pending = 0;
+		pthread_cond_signal(&aio->finished);
+	}
+	pthread_mutex_unlock(&aio->lock);
+	return NULL;
+}
+
+/* Creates the background I/O for a file descriptor, along with the
+ * spare buffer it hands back and forth with its reader or writer.
+ *
+ * Parameters:
+ *  fd - The file descriptor, read or written only through the AsyncIo
+ *       from now on
+ *  bufsize - The size of the spare buffer
+ */
+AsyncIo *makeAsyncIo(int fd, size_t bufsize) {
+	AsyncIo *aio = calloc(1, sizeof(AsyncIo));
+	if (!aio) {
+		perror("malloc AsyncIo");
+		exit(EXIT_FAILURE);
+	}
+	aio->buf = malloc(bufsize);
+	if (!aio->buf) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	aio->fd = fd;
+	aio->ring = -1;
+#ifdef HAVE_IO_URING
+	if (setupRing(aio) == 0) {
+		return aio;
+	}
+#endif
+	pthread_mutex_init(&aio->lock, NULL);
+	pthread_cond_init(&aio->submitted, NULL);
+	pthread_cond_init(&aio->finished, NULL);
+	if (pthread_create(&aio->thread, NULL, ioThread, aio)) {
+		perror("pthread_create");
+		exit(EXIT_FAILURE);
+	}
+	return aio;
+}
+
+/* Starts an operation in the background. A read is a single call for
+ * up to n bytes, while a write goes on until all n bytes are written.
+ * The bytes must be left alone until aioWait returns, and only one
+ * operation can be in flight at a time. */
+void aioSubmit(AsyncIo *aio, int op, uint8_t *data, size_t n) {
+	aio->op = op;
+	aio->data = data;
+	aio->n = n;
+	aio->result = 0;
+	aio->busy = 1;
+	if (aio->ring != -1) {
+#ifdef HAVE_IO_URING
+		ringSubmit(aio);
+#endif
+		return;
+	}
+	pthread_mutex_lock(&aio->lock);
+	aio->pending = 1;
+	pthread_cond_signal(&aio->submitted);
+	pthread_mutex_unlock(&aio->lock);
+}
+
+/* Waits for the operation in flight, if there is one. Returns the
+ * number of bytes a read got, 0 at the end of the input. */
+ssize_t aioWait(AsyncIo *aio) {
+	if (!aio->busy) {
+		return 0;
+	}
+	aio->busy = 0;
+	if (aio->ring != -1) {
+#ifdef HAVE_IO_URING
+		ssize_t res;
+		while (1) {
+			res = ringComplete(aio);
+			if (res < 0) {
+				errno = -res;
+				res = -1;
+			}
+			if (finishCall(aio, res)) {
+				break;
+			}
+			ringSubmit(aio);
+		}
+#endif
+		return aio->result;
+	}
+	pthread_mutex_lock(&aio->lock);
+	while (aio->pending) {
+		pthread_cond_wait(&aio->finished, &aio->lock);
+	}
+	pthread_mutex_unlock(&aio->lock);
+	return aio->result;
+}
+
+/* Waits for the operation in flight, then frees the AsyncIo and its
+ * spare buffer. The file descriptor is left open. */
+void aioDestroy(AsyncIo *aio) {
+	aioWait(aio);
+	if (aio->ring != -1) {
+		munmap(aio->sqes, aio->sqes_size);
+		munmap(aio->cq_map, aio->cq_map_size);
+		munmap(aio->sq_map, aio->sq_map_size);
+		close(aio->ring);
+	}
+	else {
+		pthread_mutex_lock(&aio->lock);
+		aio->stop = 1;
+		pthread_cond_signal(&aio->submitted);
+		pthread_mutex_unlock(&aio->lock);
+		pthread_join(aio->thread, NULL);
+		pthread_mutex_destroy(&aio->lock);
+		pthread_cond_destroy(&aio->submitted);
+		pthread_cond_destroy(&aio->finished);
+	}
+	free(aio->buf);
+	free(aio);
+}
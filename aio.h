@@ -0,0 +1,70 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#ifndef AIOH
+#define AIOH
+
+/* Operations an AsyncIo runs */
+#define AIO_READ 0
+#define AIO_WRITE 1
+
+/* AsyncIo: Runs one read or write at a time on a file descriptor in the
+ * background, so that a reader can fetch its next buffer and a writer
+ * can drain its last one while the caller works on the current one.
+ * The I/O goes through io_uring when the kernel has it, and through a
+ * thread of its own otherwise. */
+typedef struct AsyncIo {
+	/* File descriptor the I/O is done on */
+	int fd;
+	/* The buffer not in the caller's hands, which the operation in
+	 * flight reads into or writes from. It is swapped with the caller's
+	 * buffer, and freed with the AsyncIo. */
+	uint8_t *buf;
+	/* Set while an operation has been submitted and not waited for */
+	int busy;
+	/* The operation in flight, and the bytes left to move. A write is
+	 * resubmitted until all of its bytes are written. */
+	int op;
+	uint8_t *data;
+	size_t n;
+	/* Bytes the last read returned */
+	ssize_t result;
+
+	/* io_uring instance, -1 when the thread does the I/O */
+	int ring;
+	/* The rings, shared with the kernel */
+	void *sq_map;
+	size_t sq_map_size;
+	void *cq_map;
+	size_t cq_map_size;
+	void *sqes;
+	size_t sqes_size;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	void *cqes;
+
+	/* Thread doing the I/O when there is no ring */
+	pthread_t thread;
+	/* Set while the thread has an operation to run */
+	int pending;
+	/* Set when the thread should exit */
+	int stop;
+	/* Protects pending, stop and the operation */
+	pthread_mutex_t lock;
+	/* Signalled when an operation is submitted or stop is set */
+	pthread_cond_t submitted;
+	/* Signalled when the thread finishes an operation */
+	pthread_cond_t finished;
+} AsyncIo;
+
+AsyncIo *makeAsyncIo(int, size_t);
+void aioSubmit(AsyncIo *, int, uint8_t *, size_t);
+ssize_t aioWait(AsyncIo *);
+void aioDestroy(AsyncIo *);
+#endif
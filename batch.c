@@ -0,0 +1,293 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "bufio.h"
+#include "pool.h"
+#include "huff.h"
+#include "batch.h"
+
+/* BatchQueue: The files of a batch not yet taken by a worker */
+typedef struct BatchQueue {
+	FileList *files;
+	/* Index of the next file to hand out */
+	size_t next;
+	pthread_mutex_t lock;
+} BatchQueue;
+
+/* BatchWorker: One thread's share of a batch. A worker takes files off
+ * the queue until it is empty, keeping its context and output buffer
+ * from one file to the next. */
+typedef struct BatchWorker {
+	Task task;
+	BatchQueue *queue;
+	HuffContext *ctx;
+	/* Compressed output of the current file */
+	uint8_t *out;
+	size_t out_cap;
+	/* Number of files that could not be compressed */
+	size_t failed;
+} BatchWorker;
+
+/* Creates an empty file list */
+FileList *makeFileList(void) {
+	FileList *list = calloc(1, sizeof(FileList));
+	if (!list) {
+		perror("malloc FileList");
+		exit(EXIT_FAILURE);
+	}
+	return list;
+}
+
+/* Adds a copy of a file name to a list */
+void fileListAdd(FileList *list, const char *path) {
+	if (list->count == list->cap) {
+		list->cap = list->cap ? 2 * list->cap : 64;
+		list->paths = realloc(list->paths, list->cap * sizeof(char *));
+		if (!list->paths) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+	}
+	list->paths[list->count] = strdup(path);
+	if (!list->paths[list->count]) {
+		perror("strdup");
+		exit(EXIT_FAILURE);
+	}
+	list->count += 1;
+}
+
+/* Adds the file names in a file, one per line, to a list. Blank lines
+ * are skipped. A name of "-" reads the names from stdin. Returns 0 on
+ * success or -1 if the file can't be read. */
+int readFileList(FileList *list, const char *path) {
+	FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+	char *line = NULL;
+	size_t line_cap = 0;
+	ssize_t len;
+
+	if (!f) {
+		return -1;
+	}
+	while ((len = getline(&line, &line_cap, f)) != -1) {
+		if (len > 0 && line[len - 1] == '\n') {
+			line[--len] = '\0';
+		}
+		if (len > 0) {
+			fileListAdd(list, line);
+		}
+	}
+	free(line);
+	if (f != stdin) {
+		fclose(f);
+	}
+	return 0;
+}
+
+/* Orders file names alphabetically */
+static int pathCompare(const void *a, const void *b) {
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Adds the regular files in a directory to a list, in order of name.
+ * Hidden files and files that already end in BATCH_SUFFIX are left out,
+ * and subdirectories are not entered. Returns 0 on success or -1 if the
+ * directory can't be read. */
+int readDirectory(FileList *list, const char *dir) {
+	DIR *d = opendir(dir);
+	struct dirent *entry;
+	struct stat file_info;
+	char *path;
+	size_t name_len, first = list->count;
+	size_t suffix_len = strlen(BATCH_SUFFIX);
+
+	if (!d) {
+		return -1;
+	}
+	while ((entry = readdir(d)) != NULL) {
+		name_len = strlen(entry->d_name);
+		if (entry->d_name[0] == '.' || (name_len >= suffix_len &&
+			strcmp(entry->d_name + name_len - suffix_len,
+				BATCH_SUFFIX) == 0)) {
+			continue;
+		}
+		path = malloc(strlen(dir) + name_len + 2);
+		if (!path) {
+			perror("malloc");
+			exit(EXIT_FAILURE);
+		}
+		sprintf(path, "%s/%s", dir, entry->d_name);
+		if (stat(path, &file_info) == 0 && S_ISREG(file_info.st_mode)) {
+			fileListAdd(list, path);
+		}
+		free(path);
+	}
+	closedir(d);
+	qsort(list->paths + first, list->count - first, sizeof(char *),
+		pathCompare);
+	return 0;
+}
+
+/* Frees a file list and its names */
+void fileListDestroy(FileList *list) {
+	size_t i;
+	for (i = 0; i < list->count; i++) {
+		free(list->paths[i]);
+	}
+	free(list->paths);
+	free(list);
+}
+
+/* Compresses one file into its sibling. Returns 0 on success or -1
+ * after printing why the file could not be compressed. */
+static int compressFile(BatchWorker *worker, const char *path) {
+	int in_file, out_file;
+	struct stat file_info;
+	BufReader *in = NULL;
+	const uint8_t *data = NULL;
+	size_t n, len, bound;
+	uint8_t *out;
+	char *out_path;
+	int status;
+
+	in_file = open(path, O_RDONLY);
+	if (in_file == -1 || fstat(in_file, &file_info) == -1) {
+		perror(path);
+		if (in_file != -1) {
+			close(in_file);
+		}
+		return -1;
+	}
+	n = file_info.st_size;
+	if (n > 0) {
+		in = mapReader(in_file, n);
+		if (!in) {
+			in = makeReader(in_file, n);
+			if (readerPeek(in, n) < n) {
+				fprintf(stderr, "%s: unexpected end\n", path);
+				readerDestroy(in);
+				close(in_file);
+				return -1;
+			}
+		}
+		data = in->buf;
+	}
+	close(in_file);
+
+	bound = huffBound(n);
+	if (worker->out_cap < bound) {
+		out = realloc(worker->out, bound);
+		if (!out) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+		worker->out = out;
+		worker->out_cap = bound;
+	}
+	status = huffCompress(worker->ctx, data, n, worker->out,
+				worker->out_cap, &len);
+	if (in) {
+		readerDestroy(in);
+	}
+	if (status != HUFF_OK) {
+		fprintf(stderr, "%s: %s\n", path, huffError(status));
+		return -1;
+	}
+
+	out_path = malloc(strlen(path) + strlen(BATCH_SUFFIX) + 1);
+	if (!out_path) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	sprintf(out_path, "%s%s", path, BATCH_SUFFIX);
+	out_file = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU);
+	if (out_file == -1) {
+		perror(out_path);
+		free(out_path);
+		return -1;
+	}
+	writeAt(out_file, worker->out, len, 0);
+	close(out_file);
+	free(out_path);
+	return 0;
+}
+
+/* Task function of a worker: compresses files until none are left */
+static void runWorker(void *arg) {
+	BatchWorker *worker = arg;
+	BatchQueue *queue = worker->queue;
+	size_t i;
+
+	while (1) {
+		pthread_mutex_lock(&queue->lock);
+		i = queue->next;
+		if (i < queue->files->count) {
+			queue->next += 1;
+		}
+		pthread_mutex_unlock(&queue->lock);
+		if (i >= queue->files->count) {
+			break;
+		}
+		if (compressFile(worker, queue->files->paths[i]) == -1) {
+			worker->failed += 1;
+		}
+	}
+}
+
+/* Compresses every file of a list into a sibling file named with
+ * BATCH_SUFFIX added, in the same format hencode writes. The files are
+ * shared out between threads as they go, and each thread reuses one
+ * library context and output buffer for all of its files, so there is
+ * no per file setup beyond opening and mapping it.
+ *
+ * Parameters:
+ *  files - The files to compress
+ *  threads - Number of threads compressing files
+ *  max_len - Longest code allowed, 0 for no limit
+ *
+ * Returns the number of files that could not be compressed.
+ */
+size_t compressBatch(FileList *files, int threads, int max_len) {
+	ThreadPool *pool = makePool(threads);
+	BatchQueue queue;
+	BatchWorker *workers = calloc(threads, sizeof(BatchWorker));
+	size_t failed = 0;
+	int i;
+
+	if (!workers) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	queue.files = files;
+	queue.next = 0;
+	pthread_mutex_init(&queue.lock, NULL);
+	for (i = 0; i < threads; i++) {
+		workers[i].queue = &queue;
+		workers[i].ctx = makeHuffContext();
+		if (!workers[i].ctx) {
+			perror("malloc HuffContext");
+			exit(EXIT_FAILURE);
+		}
+		workers[i].ctx->max_len = max_len;
+		workers[i].task.fn = runWorker;
+		workers[i].task.arg = &workers[i];
+		poolSubmit(pool, &workers[i].task);
+	}
+	for (i = 0; i < threads; i++) {
+		poolWaitTask(pool, &workers[i].task);
+		failed += workers[i].failed;
+		huffContextDestroy(workers[i].ctx);
+		free(workers[i].out);
+	}
+	poolDestroy(pool);
+	pthread_mutex_destroy(&queue.lock);
+	free(workers);
+	return failed;
+}
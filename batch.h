@@ -0,0 +1,25 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifndef BATCHH
+#define BATCHH
+
+/* Added to each input file's name to name its compressed sibling */
+#define BATCH_SUFFIX ".huf"
+
+/* FileList: The names of the files a batch compresses */
+typedef struct FileList {
+	char **paths;
+	/* Number of names */
+	size_t count;
+	/* Number of names there is room for */
+	size_t cap;
+} FileList;
+
+FileList *makeFileList(void);
+void fileListAdd(FileList *, const char *);
+int readFileList(FileList *, const char *);
+int readDirectory(FileList *, const char *);
+void fileListDestroy(FileList *);
+size_t compressBatch(FileList *, int, int);
+#endif
@@ -0,0 +1,737 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "freq.h"
+#include "bufio.h"
+#include "canon.h"
+#include "dtable.h"
+#include "filerw.h"
+#include "pool.h"
+#include "block.h"
+
+/* BlockSlot: One block on its way through the worker pool */
+typedef struct BlockSlot {
+	/* Task that compresses the block */
+	Task task;
+	/* The block's input bytes. They point into the reader's buffer
+	 * when it holds the whole input, otherwise into copy. */
+	const uint8_t *data;
+	/* Number of input bytes in the block */
+	size_t n;
+	/* Buffer the block is read into when the input is streamed */
+	uint8_t *copy;
+	/* Compressed block: its code lengths and then its body */
+	BufWriter *out;
+	/* Longest code allowed, 0 for no limit */
+	int max_len;
+	/* Number of interleaved streams in the body, 1 for a single one */
+	int nstreams;
+	/* Streams after the first while the body is being written */
+	BufWriter *side[MAX_STREAMS - 1];
+} BlockSlot;
+
+/* DecodeSlot: One block on its way through the worker pool when
+ * decompressing */
+typedef struct DecodeSlot {
+	/* Task that decompresses the block */
+	Task task;
+	/* The block's code lengths and body */
+	const uint8_t *data;
+	/* Number of bytes in data */
+	size_t size;
+	/* Number of bytes the block must decompress to */
+	size_t expect;
+	/* Decompressed block */
+	BufWriter *out;
+	/* Tables the slot's blocks are decoded with */
+	BlockDecoder dec;
+	/* File the block is written straight to with writeAt, or -1 if 
+	 * blocks are written in order by the caller */
+	int fd;
+	/* Where the block goes in fd */
+	off_t offset;
+	/* Set when the body is split into interleaved streams */
+	int streamed;
+	/* Set to -1 by the worker if the block is invalid */
+	int status;
+} DecodeSlot;
+
+/* Size of the header of a blocked file: magic, version, block size */
+#define BLOCKED_HEADER_SIZE (MAGIC_LEN + 1 + 4)
+
+/* Writes a 4 byte value in network byte order */
+static void putUint32(BufWriter *out, uint32_t value) {
+	value = htonl(value);
+	writerWrite(out, &value, sizeof(uint32_t));
+}
+
+/* Writes an 8 byte value in network byte order */
+static void putUint64(BufWriter *out, uint64_t value) {
+	value = htobe64(value);
+	writerWrite(out, &value, sizeof(uint64_t));
+}
+
+/* Reads a 4 byte value in network byte order. Returns 0 on success or
+ * -1 if the input ends first. */
+static int getUint32(BufReader *in, uint32_t *value) {
+	if (readerRead(in, value, sizeof(uint32_t)) != sizeof(uint32_t)) {
+		return -1;
+	}
+	*value = ntohl(*value);
+	return 0;
+}
+
+/* Loads a 4 byte value in network byte order from memory */
+static uint32_t loadUint32(const uint8_t *buf) {
+	uint32_t value;
+	memcpy(&value, buf, sizeof(uint32_t));
+	return ntohl(value);
+}
+
+/* Loads an 8 byte value in network byte order from memory */
+static uint64_t loadUint64(const uint8_t *buf) {
+	uint64_t value;
+	memcpy(&value, buf, sizeof(uint64_t));
+	return be64toh(value);
+}
+
+/* Compresses the block in a slot with its own frequency table and
+ * codes. Run by a worker thread. */
+static void compressBlock(void *arg) {
+	BlockSlot *slot = arg;
+	FrequencyTable *freq_table = makeFreqTable();
+	BitWriter bw;
+
+	if (!freq_table) {
+		perror("malloc FrequencyTable");
+		exit(EXIT_FAILURE);
+	}
+	countFreq(slot->data, slot->n, freq_table);
+	makeCodes(freq_table, slot->max_len);
+	chooseMode(freq_table);
+	slot->out->len = 0;
+	writeLengths(slot->out, freq_table);
+	if (freq_table->stored) {
+		writerWrite(slot->out, slot->data, slot->n);
+	}
+	/* A single repeated char. has no body */
+	else if (freq_table->unique_count == 1) {
+	}
+	else if (slot->nstreams > 1) {
+		writeStreams(slot->out, slot->data, slot->n, slot->nstreams,
+				freq_table->codes, slot->side);
+	}
+	else {
+		initBitWriter(&bw, slot->out);
+		encodeBytes(slot->data, slot->n, &bw, freq_table->codes);
+		flushBits(&bw);
+	}
+	ftableDestroy(freq_table);
+}
+
+/* Loads the next block of input into a slot. Returns the number of
+ * bytes in the block, 0 once the input has run out. */
+static size_t loadBlock(BufReader *in, BlockSlot *slot, size_t block_size) {
+	size_t n;
+	/* The whole input is already in memory, so point at it */
+	if (in->fixed) {
+		n = in->len - in->pos;
+		if (n > block_size) {
+			n = block_size;
+		}
+		slot->data = in->buf + in->pos;
+		in->pos += n;
+	}
+	else {
+		if (!slot->copy) {
+			slot->copy = malloc(block_size);
+			if (!slot->copy) {
+				perror("malloc");
+				exit(EXIT_FAILURE);
+			}
+		}
+		n = readerRead(in, slot->copy, block_size);
+		slot->data = slot->copy;
+	}
+	slot->n = n;
+	return n;
+}
+
+/* Compresses the input as a series of independent blocks. Each block
+ * gets its own frequency table and codes, so blocks are compressed in
+ * parallel by a pool of threads and written out in order.
+ *
+ * Layout:
+ *  - "HUF" and the version byte, VERSION_BLOCKED for single stream
+ *    bodies or VERSION_INTERLEAVED for bodies written by writeStreams
+ *  - block_size: input bytes per block, 4 bytes. Every block but the
+ *    last holds exactly this many.
+ *  - For each block, its compressed size in 4 bytes followed by its
+ *    code lengths (as written by writeLengths) and body
+ *  - A compressed size of 0 marking the end of the blocks
+ *  - The index: the file offset of each block, 8 bytes each
+ *  - The trailer: total input size (8 bytes), file offset of the index
+ *    (8 bytes), number of blocks (4 bytes) and TRAILER_MAGIC
+ * All values are in network byte order.
+ *
+ * Parameters:
+ *  in - A buffered reader for the input file
+ *  out - A buffered writer for the output file
+ *  block_size - Number of input bytes per block
+ *  threads - Number of threads compressing blocks
+ *  max_len - Longest code allowed, 0 for no limit
+ *  nstreams - Number of interleaved streams per block, 1 to MAX_STREAMS
+ */
+void compressBlocks(BufReader *in, BufWriter *out, size_t block_size,
+			int threads, int max_len, int nstreams) {
+	int i, s;
+	ThreadPool *pool = makePool(threads);
+	/* Enough slots that every thread has a block queued up behind
+	 * the one it is working on */
+	int nslots = 2 * threads;
+	BlockSlot *slots = calloc(nslots, sizeof(BlockSlot));
+	BlockSlot *slot;
+	/* Blocks loaded and blocks written so far */
+	size_t next_read = 0, next_write = 0;
+	int input_done = 0;
+	/* Offset in the output of each block */
+	uint64_t *index;
+	size_t index_cap = 64;
+	/* Bytes written to the output and bytes of input compressed */
+	uint64_t offset, total = 0;
+
+	index = malloc(index_cap * sizeof(uint64_t));
+	if (!slots || !index) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < nslots; i++) {
+		slots[i].out = makeMemWriter(block_size / 2 + BUF_SIZE);
+		slots[i].task.fn = compressBlock;
+		slots[i].task.arg = &slots[i];
+		slots[i].max_len = max_len;
+		slots[i].nstreams = nstreams;
+		for (s = 0; s < nstreams - 1; s++) {
+			slots[i].side[s] = makeMemWriter(block_size / 
+					(2 * nstreams) + BUF_SIZE);
+		}
+	}
+
+	writerWrite(out, HUFF_MAGIC, MAGIC_LEN);
+	writerPutc(out, nstreams > 1 ? VERSION_INTERLEAVED : VERSION_BLOCKED);
+	putUint32(out, block_size);
+	offset = BLOCKED_HEADER_SIZE;
+
+	while (1) {
+		/* Keep every slot busy while there is input left */
+		while (!input_done && next_read - next_write < nslots) {
+			slot = &slots[next_read % nslots];
+			if (loadBlock(in, slot, block_size) == 0) {
+				input_done = 1;
+				break;
+			}
+			poolSubmit(pool, &slot->task);
+			next_read += 1;
+		}
+		if (next_write == next_read) {
+			break;
+		}
+		/* Wait for the oldest block so blocks are written in order */
+		slot = &slots[next_write % nslots];
+		poolWaitTask(pool, &slot->task);
+		if (next_write == index_cap) {
+			index_cap *= 2;
+			index = realloc(index, index_cap * sizeof(uint64_t));
+			if (!index) {
+				perror("realloc");
+				exit(EXIT_FAILURE);
+			}
+		}
+		index[next_write] = offset;
+		putUint32(out, slot->out->len);
+		writerWrite(out, slot->out->buf, slot->out->len);
+		offset += sizeof(uint32_t) + slot->out->len;
+		total += slot->n;
+		next_write += 1;
+	}
+
+	/* End of the blocks, then the index and trailer */
+	putUint32(out, 0);
+	offset += sizeof(uint32_t);
+	for (i = 0; i < next_write; i++) {
+		putUint64(out, index[i]);
+	}
+	putUint64(out, total);
+	putUint64(out, offset);
+	putUint32(out, next_write);
+	writerWrite(out, TRAILER_MAGIC, strlen(TRAILER_MAGIC));
+
+	poolDestroy(pool);
+	for (i = 0; i < nslots; i++) {
+		free(slots[i].copy);
+		writerDestroy(slots[i].out);
+		for (s = 0; s < nstreams - 1; s++) {
+			writerDestroy(slots[i].side[s]);
+		}
+	}
+	free(slots);
+	free(index);
+}
+
+/* Decodes the body of a block, which is a single stream or, when
+ * streamed is set, interleaved streams. Returns 0 on success or -1 if
+ * the streams are invalid or the body is cut short. */
+static int decodeBody(BufReader *block, BufWriter *out, DecodeTable *table,
+		FrequencyTable *freq_table, int streamed) {
+	if (streamed) {
+		return decodeStreams(block, out, table, freq_table);
+	}
+	return decode(block, out, table, freq_table);
+}
+
+/* Decompresses the blocks of a blocked file one after the other. Only
+ * the blocks themselves are read, so this works on a pipe.
+ *
+ * Parameters:
+ *  in - A buffered reader positioned just after the version byte
+ *  out - A buffered writer for the output file
+ *  version - The file's version, VERSION_BLOCKED or VERSION_INTERLEAVED
+ */
+void decompressBlocks(BufReader *in, BufWriter *out, int version) {
+	uint32_t block_size, size;
+	/* Holds one compressed block at a time */
+	uint8_t *buf = NULL;
+	size_t buf_cap = 0;
+	BufReader *block;
+	FrequencyTable *freq_table;
+	DecodeTable *table;
+
+	if (getUint32(in, &block_size) == -1) {
+		fprintf(stderr, "truncated header\n");
+		exit(EXIT_FAILURE);
+	}
+	while (1) {
+		if (getUint32(in, &size) == -1) {
+			fprintf(stderr, "truncated block\n");
+			exit(EXIT_FAILURE);
+		}
+		/* End of the blocks */
+		if (size == 0) {
+			break;
+		}
+		if (size > buf_cap) {
+			buf_cap = size;
+			buf = realloc(buf, buf_cap);
+			if (!buf) {
+				perror("realloc");
+				exit(EXIT_FAILURE);
+			}
+		}
+		if (readerRead(in, buf, size) != size) {
+			fprintf(stderr, "truncated block\n");
+			exit(EXIT_FAILURE);
+		}
+
+		/* Each block is read on its own so that decoding never runs
+		 * into the next one */
+		block = memReader(buf, size);
+		freq_table = makeFreqTable();
+		if (!freq_table) {
+			perror("malloc FrequencyTable");
+			exit(EXIT_FAILURE);
+		}
+		if (readLengths(block, freq_table) == -1
+				|| freq_table->count > block_size) {
+			fprintf(stderr, "invalid block header\n");
+			exit(EXIT_FAILURE);
+		}
+		table = makeLengthsTable(freq_table);
+		if (!table) {
+			perror("malloc DecodeTable");
+			exit(EXIT_FAILURE);
+		}
+		if (decodeBody(block, out, table, freq_table, 
+				version == VERSION_INTERLEAVED) == -1) {
+			fprintf(stderr, "invalid block body\n");
+			exit(EXIT_FAILURE);
+		}
+		dtableDestroy(table);
+		ftableDestroy(freq_table);
+		readerDestroy(block);
+	}
+	free(buf);
+}
+
+/* Reads the index of a blocked file that is entirely in memory, using
+ * the trailer at its end. Every offset is checked to lie inside the
+ * file, so blocks can be handed out without further checks.
+ *
+ * Parameters:
+ *  buf - The whole blocked file
+ *  len - The size of the file
+ *  result - Set to the index
+ *
+ * Returns 0, -1 if the file has no valid index, or BLOCK_NOMEM if the
+ * index can't be allocated.
+ */
+int readIndex(const uint8_t *buf, size_t len, BlockIndex **result) {
+	uint32_t i;
+	const uint8_t *trailer;
+	BlockIndex *index;
+	/* End of the block being checked */
+	uint64_t end;
+
+	if (len < BLOCKED_HEADER_SIZE + sizeof(uint32_t) + TRAILER_SIZE) {
+		return -1;
+	}
+	trailer = buf + len - TRAILER_SIZE;
+	if (memcmp(trailer + TRAILER_SIZE - strlen(TRAILER_MAGIC), 
+			TRAILER_MAGIC, strlen(TRAILER_MAGIC)) != 0) {
+		return -1;
+	}
+	index = malloc(sizeof(BlockIndex));
+	if (!index) {
+		return BLOCK_NOMEM;
+	}
+	index->streamed = buf[MAGIC_LEN] == VERSION_INTERLEAVED;
+	index->block_size = loadUint32(buf + MAGIC_LEN + 1);
+	index->total = loadUint64(trailer);
+	index->index_offset = loadUint64(trailer + sizeof(uint64_t));
+	index->nblocks = loadUint32(trailer + 2 * sizeof(uint64_t));
+	index->offsets = NULL;
+
+	/* The index must sit exactly between the end marker and the
+	 * trailer, and the blocks must cover the total size */
+	if (index->block_size == 0
+		|| index->nblocks > len / sizeof(uint64_t)
+		|| index->index_offset < BLOCKED_HEADER_SIZE + sizeof(uint32_t)
+		|| index->index_offset + (uint64_t)index->nblocks * 
+			sizeof(uint64_t) + TRAILER_SIZE != len
+		|| (index->total + index->block_size - 1) / index->block_size
+			!= index->nblocks) {
+		indexDestroy(index);
+		return -1;
+	}
+	index->offsets = malloc((index->nblocks + 1) * sizeof(uint64_t));
+	if (!index->offsets) {
+		indexDestroy(index);
+		return BLOCK_NOMEM;
+	}
+	for (i = 0; i < index->nblocks; i++) {
+		index->offsets[i] = loadUint64(buf + index->index_offset +
+						i * sizeof(uint64_t));
+	}
+	/* Each block must fit before the next one, and the last before
+	 * the end marker */
+	for (i = 0; i < index->nblocks; i++) {
+		end = i + 1 < index->nblocks ? index->offsets[i + 1] :
+				index->index_offset - sizeof(uint32_t);
+		if (index->offsets[i] < BLOCKED_HEADER_SIZE
+			|| index->offsets[i] + sizeof(uint32_t) > end
+			|| index->offsets[i] + sizeof(uint32_t) + 
+				loadUint32(buf + index->offsets[i]) > end) {
+			indexDestroy(index);
+			return -1;
+		}
+	}
+	*result = index;
+	return 0;
+}
+
+/* Frees a block index */
+void indexDestroy(BlockIndex *index) {
+	free(index->offsets);
+	free(index);
+}
+
+/* Returns the number of bytes block i of an index decompresses to */
+static uint64_t blockLength(const BlockIndex *index, uint32_t i) {
+	if (i == index->nblocks - 1) {
+		return index->total - (uint64_t)i * index->block_size;
+	}
+	return index->block_size;
+}
+
+/* Decompresses the first limit bytes of a block into a writer, which
+ * is emptied first. Decoding stops there, so a block is only decoded as
+ * far as it is needed.
+ *
+ * Parameters:
+ *  data - The block's code lengths and body
+ *  size - The number of bytes in data
+ *  expect - The number of bytes the block must decompress to
+ *  limit - The number of bytes to decompress, at most expect
+ *  streamed - Set when the body is split into interleaved streams
+ *  dec - The tables to decode with
+ *  out - A memory writer the bytes go to
+ *
+ * Returns 0 on success, -1 if the block header is invalid, or
+ * BLOCK_NOMEM if the block's decode table can't be allocated.
+ */
+static int decodeBlock(const uint8_t *data, size_t size, uint64_t expect,
+		uint64_t limit, int streamed, BlockDecoder *dec,
+		BufWriter *out) {
+	FrequencyTable *freq_table = dec->freq_table;
+	BufReader block;
+
+	memset(freq_table, 0, sizeof(FrequencyTable));
+	freq_table->size = MAX_NUM_BYTES;
+	initMemReader(&block, data, size);
+	if (readLengths(&block, freq_table) == -1 
+			|| freq_table->count != expect) {
+		return -1;
+	}
+	if (!dec->table) {
+		dec->table = makeLengthsTable(freq_table);
+		if (!dec->table) {
+			return BLOCK_NOMEM;
+		}
+	}
+	else if (loadLengthsTable(dec->table, freq_table) == -1) {
+		return BLOCK_NOMEM;
+	}
+	out->len = 0;
+	freq_table->count = limit;
+	return decodeBody(&block, out, dec->table, freq_table, streamed);
+}
+
+/* Sets up the tables of a BlockDecoder. Returns 0, or BLOCK_NOMEM if
+ * they can't be allocated. */
+static int initDecoder(BlockDecoder *dec) {
+	dec->table = NULL;
+	dec->freq_table = makeFreqTable();
+	return dec->freq_table ? 0 : BLOCK_NOMEM;
+}
+
+/* Frees the tables of a BlockDecoder */
+static void decoderDestroy(BlockDecoder *dec) {
+	if (dec->table) {
+		dtableDestroy(dec->table);
+	}
+	ftableDestroy(dec->freq_table);
+}
+
+/* Decompresses the block in a slot. Run by a worker thread. */
+static void decompressBlock(void *arg) {
+	DecodeSlot *slot = arg;
+
+	slot->status = decodeBlock(slot->data, slot->size, slot->expect, 
+			slot->expect, slot->streamed, &slot->dec, slot->out);
+	if (slot->status == 0 && slot->fd != -1) {
+		writeAt(slot->fd, slot->out->buf, slot->out->len, 
+				slot->offset);
+	}
+}
+
+/* Decompresses a blocked file that is entirely in memory, handing its
+ * blocks to a pool of threads. When the output is a regular file each
+ * thread writes its block straight to the block's place in the file;
+ * otherwise blocks are written out in order.
+ *
+ * Parameters:
+ *  in - A reader whose buffer holds the whole file
+ *  out - A buffered writer for the output file
+ *  threads - Number of threads decompressing blocks
+ */
+void decompressBlocksParallel(BufReader *in, BufWriter *out, int threads) {
+	int i, status;
+	BlockIndex *index;
+	ThreadPool *pool;
+	int nslots = 2 * threads;
+	DecodeSlot *slots;
+	DecodeSlot *slot;
+	size_t next_read = 0, next_write = 0;
+	struct stat out_info;
+	/* Output file offset of the first block, -1 if blocks are written
+	 * in order through out */
+	off_t base = -1;
+
+	status = readIndex(in->buf, in->len, &index);
+	if (status == BLOCK_NOMEM) {
+		perror("malloc BlockIndex");
+		exit(EXIT_FAILURE);
+	}
+	if (status == -1) {
+		fprintf(stderr, "invalid block index\n");
+		exit(EXIT_FAILURE);
+	}
+	writerSync(out);
+	/* pwrite ignores the offset on a file opened for appending, so
+	 * blocks then go through out in order */
+	if (fstat(out->fd, &out_info) == 0 && S_ISREG(out_info.st_mode)
+			&& (fcntl(out->fd, F_GETFL) & O_APPEND) == 0) {
+		base = lseek(out->fd, 0, SEEK_CUR);
+	}
+
+	pool = makePool(threads);
+	slots = calloc(nslots, sizeof(DecodeSlot));
+	if (!slots) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < nslots; i++) {
+		slots[i].out = makeMemWriter(index->block_size);
+		if (initDecoder(&slots[i].dec) == BLOCK_NOMEM) {
+			perror("malloc FrequencyTable");
+			exit(EXIT_FAILURE);
+		}
+		slots[i].fd = base == -1 ? -1 : out->fd;
+		slots[i].streamed = index->streamed;
+		slots[i].task.fn = decompressBlock;
+		slots[i].task.arg = &slots[i];
+	}
+
+	while (next_write < index->nblocks) {
+		/* Keep every slot busy while there are blocks left */
+		while (next_read < index->nblocks 
+				&& next_read - next_write < nslots) {
+			slot = &slots[next_read % nslots];
+			slot->data = in->buf + index->offsets[next_read] + 
+					sizeof(uint32_t);
+			slot->size = loadUint32(in->buf + 
+					index->offsets[next_read]);
+			slot->offset = base + (off_t)next_read * 
+					index->block_size;
+			slot->expect = blockLength(index, next_read);
+			poolSubmit(pool, &slot->task);
+			next_read += 1;
+		}
+		slot = &slots[next_write % nslots];
+		poolWaitTask(pool, &slot->task);
+		if (slot->status == BLOCK_NOMEM) {
+			fprintf(stderr, "out of memory decoding block\n");
+			exit(EXIT_FAILURE);
+		}
+		if (slot->status == -1) {
+			fprintf(stderr, "invalid block header\n");
+			exit(EXIT_FAILURE);
+		}
+		if (base == -1) {
+			writerWrite(out, slot->out->buf, slot->out->len);
+		}
+		next_write += 1;
+	}
+	/* Leave the file position after the last block, as if the blocks
+	 * had been written in order */
+	if (base != -1 
+		&& lseek(out->fd, base + index->total, SEEK_SET) == -1) {
+		perror("lseek");
+		exit(EXIT_FAILURE);
+	}
+
+	poolDestroy(pool);
+	for (i = 0; i < nslots; i++) {
+		writerDestroy(slots[i].out);
+		decoderDestroy(&slots[i].dec);
+	}
+	free(slots);
+	indexDestroy(index);
+}
+
+/* Decompresses part of a blocked file that is entirely in memory. Only
+ * the blocks holding the requested bytes are decoded, found through the
+ * index, and the last of them only up to the end of the range.
+ *
+ * Parameters:
+ *  buf - The whole blocked file
+ *  index - The file's index from readIndex
+ *  offset - Offset in the decompressed file of the first byte wanted
+ *  end - Offset just past the last byte wanted, at most index->total
+ *  dec - The tables to decode with, kept for the next range
+ *  block - A memory writer the blocks are decoded into, grown to the
+ *          block size if it is smaller
+ *  out - A buffered writer the bytes go to
+ *
+ * Returns the number of bytes written, -1 if a block is invalid, or
+ * BLOCK_NOMEM if memory runs out.
+ */
+int64_t decodeRange(const uint8_t *buf, const BlockIndex *index,
+		uint64_t offset, uint64_t end, BlockDecoder *dec,
+		BufWriter *block, BufWriter *out) {
+	uint64_t start, stop;
+	uint32_t i;
+	int64_t written = 0;
+	uint8_t *grown;
+	int status;
+
+	/* A whole block fits, so the writer never has to grow mid-block */
+	if (block->size < index->block_size) {
+		grown = realloc(block->buf, index->block_size);
+		if (!grown) {
+			return BLOCK_NOMEM;
+		}
+		block->buf = grown;
+		block->size = index->block_size;
+	}
+	for (i = offset / index->block_size; offset < end; i++) {
+		/* Part of block i that is wanted */
+		start = offset - (uint64_t)i * index->block_size;
+		stop = end - (uint64_t)i * index->block_size;
+		if (stop > blockLength(index, i)) {
+			stop = blockLength(index, i);
+		}
+		status = decodeBlock(buf + index->offsets[i] + sizeof(uint32_t),
+			loadUint32(buf + index->offsets[i]),
+			blockLength(index, i), stop, index->streamed, dec,
+			block);
+		if (status != 0) {
+			return status;
+		}
+		writerWrite(out, block->buf + start, stop - start);
+		written += stop - start;
+		offset += stop - start;
+	}
+	return written;
+}
+
+/* Decompresses part of a blocked file that is entirely in memory with
+ * decodeRange. A range running past the end of the file is cut short
+ * there.
+ *
+ * Parameters:
+ *  buf - The whole blocked file
+ *  len - The size of the file
+ *  offset - Offset in the decompressed file of the first byte wanted
+ *  length - Number of bytes wanted
+ *  out - A buffered writer the bytes go to
+ *
+ * Returns the number of bytes written, -1 if the file has no valid
+ * index or a block is invalid, RANGE_PAST_END if offset is past the
+ * end of the file, or BLOCK_NOMEM if memory runs out.
+ */
+int64_t decompressRange(const uint8_t *buf, size_t len, uint64_t offset,
+		uint64_t length, BufWriter *out) {
+	BlockIndex *index;
+	BlockDecoder dec;
+	BufWriter *block;
+	uint64_t end;
+	int64_t written;
+	int status;
+
+	status = readIndex(buf, len, &index);
+	if (status != 0) {
+		return status;
+	}
+	if (offset > index->total) {
+		indexDestroy(index);
+		return RANGE_PAST_END;
+	}
+	if (initDecoder(&dec) == BLOCK_NOMEM) {
+		indexDestroy(index);
+		return BLOCK_NOMEM;
+	}
+	end = length > index->total - offset ? index->total : offset + length;
+	block = makeMemWriter(index->block_size);
+	written = decodeRange(buf, index, offset, end, &dec, block, out);
+	writerDestroy(block);
+	decoderDestroy(&dec);
+	indexDestroy(index);
+	return written;
+}
@@ -0,0 +1,61 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifndef BLOCKH
+#define BLOCKH
+#include "bufio.h"
+#include "freq.h"
+#include "dtable.h"
+
+/* Number of input bytes in a block when -B is not given */
+#define DEFAULT_BLOCK_SIZE (1 << 20)
+/* Largest block. A block's count and its compressed size are both
+ * stored in 4 bytes, and a block stored as it is takes a few bytes more
+ * than it holds, so blocks stay well short of 4G. */
+#define MAX_BLOCK_SIZE (1UL << 30)
+/* Magic bytes that end a blocked file */
+#define TRAILER_MAGIC "HUFI"
+/* Size of the trailer: total size, index offset, block count, magic */
+#define TRAILER_SIZE 24
+/* Returned by decompressRange when the range starts past the end */
+#define RANGE_PAST_END -2
+/* Returned by readIndex and decompressRange when memory runs out */
+#define BLOCK_NOMEM -3
+
+/* BlockIndex: Where every block of a blocked file starts, read from the
+ * index at the end of the file */
+typedef struct BlockIndex {
+	/* Input bytes per block. Every block but the last holds exactly 
+	 * this many. */
+	uint32_t block_size;
+	/* Total number of bytes the file decompresses to */
+	uint64_t total;
+	/* Number of blocks */
+	uint32_t nblocks;
+	/* File offset of each block's compressed size */
+	uint64_t *offsets;
+	/* File offset of the index, just past the end marker */
+	uint64_t index_offset;
+	/* Set when block bodies are split into interleaved streams */
+	int streamed;
+} BlockIndex;
+
+/* BlockDecoder: The tables blocks are decoded with, kept from one block
+ * to the next so that a decode table is only allocated again when a
+ * block needs more slots than any before it */
+typedef struct BlockDecoder {
+	FrequencyTable *freq_table;
+	/* NULL until the first block */
+	DecodeTable *table;
+} BlockDecoder;
+
+void compressBlocks(BufReader *, BufWriter *, size_t, int, int, int);
+int readIndex(const uint8_t *, size_t, BlockIndex **);
+void indexDestroy(BlockIndex *);
+void decompressBlocks(BufReader *, BufWriter *, int);
+void decompressBlocksParallel(BufReader *, BufWriter *, int);
+int64_t decodeRange(const uint8_t *, const BlockIndex *, uint64_t, uint64_t,
+		BlockDecoder *, BufWriter *, BufWriter *);
+int64_t decompressRange(const uint8_t *, size_t, uint64_t, uint64_t, 
+		BufWriter *);
+#endif
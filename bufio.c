@@ -0,0 +1,581 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <endian.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bufio.h"
+
+/* Counts of the syscalls made by every reader and writer */
+IoCounters io_counters;
+
+/* Counts one syscall, and the bytes it moved if it succeeded. Blocks
+ * are read and written from several threads, so the counts are kept
+ * with atomic adds. */
+void countCall(uint64_t *calls, uint64_t *bytes, ssize_t status) {
+	__atomic_add_fetch(calls, 1, __ATOMIC_RELAXED);
+	if (status > 0) {
+		__atomic_add_fetch(bytes, status, __ATOMIC_RELAXED);
+	}
+}
+
+/* Creates a reader over fdin with a buffer of bufsize bytes */
+BufReader *makeReader(int fdin, size_t bufsize) {
+	BufReader *in = malloc(sizeof(BufReader));
+	if (!in) {
+		perror("malloc BufReader");
+		exit(EXIT_FAILURE);
+	}
+	if (bufsize == 0) {
+		bufsize = BUF_SIZE;
+	}
+	in->buf = malloc(bufsize);
+	if (!in->buf) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	in->fd = fdin;
+	in->size = bufsize;
+	in->pos = 0;
+	in->len = 0;
+	in->eof = 0;
+	in->fixed = 0;
+	in->mapped = 0;
+	in->aio = NULL;
+	return in;
+}
+
+/* Creates a reader over fdin that reads its next bufsize bytes in the
+ * background while the caller works through the current ones. The first
+ * read is started right away. */
+BufReader *makeAsyncReader(int fdin, size_t bufsize) {
+	BufReader *in = makeReader(fdin, bufsize);
+	/* Both buffers have room for a whole buffer of unread bytes in
+	 * front of where reads land */
+	free(in->buf);
+	in->buf = malloc(2 * in->size);
+	if (!in->buf) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	in->aio = makeAsyncIo(fdin, 2 * in->size);
+	aioSubmit(in->aio, AIO_READ, in->aio->buf + in->size, in->size);
+	return in;
+}
+
+/* Creates a reader whose buffer is the whole of a regular file mapped
+ * into memory, so the file can be walked any number of times without
+ * copying it. Returns NULL if the file cannot be mapped, in which case
+ * the caller should fall back to makeReader.
+ *
+ * Parameters:
+ *  fdin - A file descriptor for a regular file
+ *  size - The size of the file, which must be greater than 0
+ */
+BufReader *mapReader(int fdin, size_t size) {
+	BufReader *in;
+	size_t map_size = size;
+	void *map;
+
+	/* Large files get a length the kernel can cover with huge pages.
+	 * Nothing past the end of the file is ever touched. */
+	if (map_size >= HUGE_PAGE_SIZE) {
+		map_size = (map_size + HUGE_PAGE_SIZE - 1) & 
+					~((size_t)HUGE_PAGE_SIZE - 1);
+	}
+	map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fdin, 0);
+	countCall(&io_counters.map_calls, &io_counters.bytes_mapped,
+			map == MAP_FAILED ? -1 : (ssize_t)size);
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+	/* Both passes walk the file front to back */
+	madvise(map, map_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+	if (map_size >= HUGE_PAGE_SIZE) {
+		madvise(map, map_size, MADV_HUGEPAGE);
+	}
+#endif
+
+	in = malloc(sizeof(BufReader));
+	if (!in) {
+		perror("malloc BufReader");
+		exit(EXIT_FAILURE);
+	}
+	in->fd = fdin;
+	in->buf = map;
+	in->size = size;
+	in->pos = 0;
+	in->len = size;
+	/* The whole file is already in the buffer */
+	in->eof = 1;
+	in->fixed = 1;
+	in->mapped = map_size;
+	in->aio = NULL;
+	return in;
+}
+
+/* Sets up a reader that the caller owns over bytes that are already in
+ * memory, so that no allocation is needed */
+void initMemReader(BufReader *in, const void *buf, size_t len) {
+	in->fd = -1;
+	in->buf = (uint8_t *)buf;
+	in->size = len;
+	in->pos = 0;
+	in->len = len;
+	in->eof = 1;
+	in->fixed = 1;
+	in->mapped = 0;
+	in->aio = NULL;
+}
+
+/* Creates a reader over bytes that are already in memory. The bytes are
+ * not copied and must outlive the reader, which does not free them. */
+BufReader *memReader(const void *buf, size_t len) {
+	BufReader *in = malloc(sizeof(BufReader));
+	if (!in) {
+		perror("malloc BufReader");
+		exit(EXIT_FAILURE);
+	}
+	initMemReader(in, buf, len);
+	return in;
+}
+
+/* Refills a reader whose reads are made in the background. The read
+ * started last time is waited for, the unread bytes are copied in front
+ * of what it got, and the buffers are swapped. The next read is then
+ * started into the buffer just given up. */
+static size_t asyncFill(BufReader *in) {
+	size_t left = in->len - in->pos;
+	uint8_t *next;
+	ssize_t got;
+
+	if (in->eof || left >= in->size) {
+		return left;
+	}
+	got = aioWait(in->aio);
+	next = in->aio->buf;
+	memcpy(next + in->size - left, in->buf + in->pos, left);
+	in->aio->buf = in->buf;
+	in->buf = next;
+	in->pos = in->size - left;
+	in->len = in->size + got;
+	if (got == 0) {
+		in->eof = 1;
+	}
+	else {
+		aioSubmit(in->aio, AIO_READ, in->aio->buf + in->size, 
+				in->size);
+	}
+	return in->len - in->pos;
+}
+
+/* Refills the reader's buffer. Any unread bytes are moved to the front
+ * of the buffer first, then a single read is made into the free space.
+ * Returns the number of unread bytes now available, which is 0 only once
+ * the end of the input has been reached. */
+size_t readerFill(BufReader *in) {
+	ssize_t status;
+	size_t left = in->len - in->pos;
+
+	/* A mapped file or memory block is never refilled or moved */
+	if (in->fixed) {
+		return left;
+	}
+	if (in->aio) {
+		return asyncFill(in);
+	}
+	if (left > 0 && in->pos > 0) {
+		memmove(in->buf, in->buf + in->pos, left);
+	}
+	in->pos = 0;
+	in->len = left;
+
+	while (!in->eof && in->len < in->size) {
+		status = read(in->fd, in->buf + in->len, in->size - in->len);
+		countCall(&io_counters.read_calls, &io_counters.bytes_read, 
+				status);
+		if (status == -1) {
+			/* Interrupted before anything was read, try again */
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("error reading file");
+			exit(EXIT_FAILURE);
+		}
+		if (status == 0) {
+			in->eof = 1;
+		}
+		in->len += status;
+		/* A short read is fine, the caller only needs some bytes */
+		break;
+	}
+	return in->len - in->pos;
+}
+
+/* Makes sure at least n unread bytes are in the buffer without using
+ * them up, reading more as needed. Returns the number of unread bytes,
+ * which is less than n only when the input runs out first. */
+size_t readerPeek(BufReader *in, size_t n) {
+	while (in->len - in->pos < n && !in->eof 
+			&& in->len - in->pos < in->size) {
+		readerFill(in);
+	}
+	return in->len - in->pos;
+}
+
+/* Copies up to n bytes out of the reader into dest. Fewer than n bytes
+ * are returned only when the input runs out. */
+size_t readerRead(BufReader *in, void *dest, size_t n) {
+	size_t copied = 0;
+	size_t chunk;
+	while (copied < n) {
+		if (in->pos == in->len && readerFill(in) == 0) {
+			break;
+		}
+		chunk = in->len - in->pos;
+		if (chunk > n - copied) {
+			chunk = n - copied;
+		}
+		memcpy((uint8_t *)dest + copied, in->buf + in->pos, chunk);
+		in->pos += chunk;
+		copied += chunk;
+	}
+	return copied;
+}
+
+/* Moves the reader back to the start of its file and drops anything
+ * left in the buffer */
+void readerRewind(BufReader *in) {
+	/* A mapped file or memory block only needs its position reset */
+	if (in->fixed) {
+		in->pos = 0;
+		return;
+	}
+	/* The read ahead is thrown away */
+	if (in->aio) {
+		aioWait(in->aio);
+	}
+	if (lseek(in->fd, 0, SEEK_SET) == -1) {
+		perror("lseek");
+		exit(EXIT_FAILURE);
+	}
+	in->pos = 0;
+	in->len = 0;
+	in->eof = 0;
+	if (in->aio) {
+		aioSubmit(in->aio, AIO_READ, in->aio->buf + in->size, 
+				in->size);
+	}
+}
+
+/* Frees the reader. The file descriptor is left open. */
+void readerDestroy(BufReader *in) {
+	if (in->mapped) {
+		munmap(in->buf, in->mapped);
+	}
+	else if (!in->fixed) {
+		free(in->buf);
+	}
+	if (in->aio) {
+		aioDestroy(in->aio);
+	}
+	free(in);
+}
+
+/* Creates a writer over fdout with a buffer of bufsize bytes */
+BufWriter *makeWriter(int fdout, size_t bufsize) {
+	BufWriter *out = malloc(sizeof(BufWriter));
+	if (!out) {
+		perror("malloc BufWriter");
+		exit(EXIT_FAILURE);
+	}
+	if (bufsize == 0) {
+		bufsize = BUF_SIZE;
+	}
+	out->buf = malloc(bufsize);
+	if (!out->buf) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	out->fd = fdout;
+	out->size = bufsize;
+	out->len = 0;
+	out->aio = NULL;
+	return out;
+}
+
+/* Creates a writer over fdout that writes each full buffer in the
+ * background and goes on filling a second one meanwhile */
+BufWriter *makeAsyncWriter(int fdout, size_t bufsize) {
+	BufWriter *out = makeWriter(fdout, bufsize);
+	if (fdout != -1) {
+		out->aio = makeAsyncIo(fdout, out->size);
+	}
+	return out;
+}
+
+/* Creates a writer that collects its output in memory, starting with a
+ * buffer of bufsize bytes */
+BufWriter *makeMemWriter(size_t bufsize) {
+	return makeWriter(-1, bufsize);
+}
+
+/* Writes n bytes from src through the writer */
+void writerWrite(BufWriter *out, const void *src, size_t n) {
+	const uint8_t *bytes = src;
+	size_t chunk;
+	while (n > 0) {
+		if (out->len == out->size) {
+			writerFlush(out);
+		}
+		chunk = out->size - out->len;
+		if (chunk > n) {
+			chunk = n;
+		}
+		memcpy(out->buf + out->len, bytes, chunk);
+		out->len += chunk;
+		bytes += chunk;
+		n -= chunk;
+	}
+}
+
+/* Writes everything in the buffer to the file descriptor, retrying on
+ * short writes and interrupted calls. A memory writer instead doubles
+ * its buffer once it is full and keeps its contents. A writer with
+ * background writes waits for the last buffer to be written, starts
+ * writing this one and carries on in the other; writerSync waits for
+ * the bytes to reach the file. */
+void writerFlush(BufWriter *out) {
+	ssize_t status;
+	size_t done = 0;
+	uint8_t *spare;
+	if (out->fd == -1) {
+		if (out->len == out->size) {
+			out->size *= 2;
+			out->buf = realloc(out->buf, out->size);
+			if (!out->buf) {
+				perror("realloc");
+				exit(EXIT_FAILURE);
+			}
+		}
+		return;
+	}
+	if (out->aio) {
+		if (out->len == 0) {
+			return;
+		}
+		aioWait(out->aio);
+		spare = out->aio->buf;
+		out->aio->buf = out->buf;
+		aioSubmit(out->aio, AIO_WRITE, out->buf, out->len);
+		out->buf = spare;
+		out->len = 0;
+		return;
+	}
+	while (done < out->len) {
+		status = write(out->fd, out->buf + done, out->len - done);
+		countCall(&io_counters.write_calls, 
+				&io_counters.bytes_written, status);
+		if (status == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("error writing file");
+			exit(EXIT_FAILURE);
+		}
+		done += status;
+	}
+	out->len = 0;
+}
+
+/* Writes out everything in the buffer and waits until it has been
+ * written, so that the file can be used directly afterwards */
+void writerSync(BufWriter *out) {
+	writerFlush(out);
+	if (out->aio) {
+		aioWait(out->aio);
+	}
+}
+
+/* Writes n bytes to a file descriptor at an offset without moving its
+ * file position, retrying on short writes and interrupted calls */
+void writeAt(int fdout, const void *src, size_t n, off_t offset) {
+	ssize_t status;
+	size_t done = 0;
+	while (done < n) {
+		status = pwrite(fdout, (const uint8_t *)src + done, n - done,
+				offset + done);
+		countCall(&io_counters.write_calls, 
+				&io_counters.bytes_written, status);
+		if (status == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("error writing file");
+			exit(EXIT_FAILURE);
+		}
+		done += status;
+	}
+}
+
+/* Grows the file under a writer by n bytes and maps them into memory,
+ * so that they can be filled in place, in any order and by several
+ * threads at once. Anything still buffered is written out first. The
+ * new bytes are not cleared if the file already ran past them. Returns
+ * NULL if the output is not a regular file opened for reading and
+ * writing and not for appending, in which case the file is left as it
+ * was and the bytes have to go through the writer.
+ *
+ * Parameters:
+ *  out - The writer whose file is grown
+ *  n - The number of bytes to map, which must be greater than 0
+ */
+uint8_t *mapOutput(BufWriter *out, size_t n) {
+	struct stat file_info;
+	off_t base, start;
+	uint8_t *map;
+	int flags;
+
+	writerSync(out);
+	if (out->fd == -1 || fstat(out->fd, &file_info) == -1 ||
+			!S_ISREG(file_info.st_mode)) {
+		return NULL;
+	}
+	/* A shared writable mapping needs the file open for reading too,
+	 * and writes to a file opened for appending land at its end */
+	flags = fcntl(out->fd, F_GETFL);
+	if (flags == -1 || (flags & O_ACCMODE) != O_RDWR || 
+			(flags & O_APPEND)) {
+		return NULL;
+	}
+	if ((base = lseek(out->fd, 0, SEEK_CUR)) == -1) {
+		return NULL;
+	}
+	if (ftruncate(out->fd, base + n) == -1) {
+		/* Undo whatever part of the grow took effect */
+		ftruncate(out->fd, file_info.st_size);
+		return NULL;
+	}
+	/* Mappings start on a page, which the file position need not */
+	start = base & ~((off_t)sysconf(_SC_PAGESIZE) - 1);
+	map = mmap(NULL, base - start + n, PROT_READ | PROT_WRITE, MAP_SHARED,
+			out->fd, start);
+	countCall(&io_counters.map_calls, &io_counters.bytes_mapped,
+			map == MAP_FAILED ? -1 : (ssize_t)n);
+	if (map == MAP_FAILED) {
+		/* Put the file back the way it was, so that the bytes can be
+		 * written through the writer at base instead */
+		if (ftruncate(out->fd, file_info.st_size) == -1) {
+			perror("ftruncate");
+			exit(EXIT_FAILURE);
+		}
+		return NULL;
+	}
+	return map + (base - start);
+}
+
+/* Unmaps n bytes mapped by mapOutput and moves the file position past
+ * them, so that anything written afterwards follows them */
+void unmapOutput(BufWriter *out, uint8_t *dst, size_t n) {
+	size_t lead = (uintptr_t)dst & (sysconf(_SC_PAGESIZE) - 1);
+	munmap(dst - lead, lead + n);
+	if (lseek(out->fd, n, SEEK_CUR) == -1) {
+		perror("lseek");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* Flushes and frees the writer. The file descriptor is left open. */
+void writerDestroy(BufWriter *out) {
+	writerSync(out);
+	if (out->aio) {
+		aioDestroy(out->aio);
+	}
+	free(out->buf);
+	free(out);
+}
+
+/* Sets up a bit writer with no pending bits over a BufWriter */
+void initBitWriter(BitWriter *bw, BufWriter *out) {
+	bw->out = out;
+	bw->acc = 0;
+	bw->nbits = 0;
+}
+
+/* Writes a full 64 bit word to the bit writer's output, most 
+ * significant byte first */
+void putWord(BitWriter *bw, uint64_t word) {
+	BufWriter *out = bw->out;
+	word = htobe64(word);
+	if (out->size - out->len >= sizeof(uint64_t)) {
+		memcpy(out->buf + out->len, &word, sizeof(uint64_t));
+		out->len += sizeof(uint64_t);
+	}
+	else {
+		writerWrite(out, &word, sizeof(uint64_t));
+	}
+}
+
+/* Starts a bit reader at the first bit of a stream of n bytes */
+void initBitReader(BitReader *br, const uint8_t *buf, size_t n) {
+	br->pos = buf;
+	br->end = buf + n;
+	br->acc = 0;
+	br->nbits = 0;
+	refillBits(br);
+}
+
+/* Writes out any pending bits, padded with zeros to a whole byte. The
+ * bit writer is left empty. */
+void flushBits(BitWriter *bw) {
+	uint64_t word;
+	int nbytes;
+	if (bw->nbits == 0) {
+		return;
+	}
+	/* Move the pending bits to the top of the word */
+	word = htobe64(bw->acc << (64 - bw->nbits));
+	nbytes = (bw->nbits + 7) / 8;
+	writerWrite(bw->out, &word, nbytes);
+	bw->acc = 0;
+	bw->nbits = 0;
+}
+
+/* Parses a size given on the command line as plain decimal digits. A K,
+ * M or G suffix scales it by the matching power of 1024. Returns 0 if it
+ * isn't a size or doesn't fit in a size_t. */
+size_t parseSize(const char *arg) {
+	char *end;
+	unsigned long long size;
+	int shift = 0;
+	/* strtoull would take a sign or leading space as well */
+	if (!isdigit((unsigned char)*arg)) {
+		return 0;
+	}
+	errno = 0;
+	size = strtoull(arg, &end, 10);
+	if (errno == ERANGE) {
+		return 0;
+	}
+	switch (toupper((unsigned char)*end)) {
+		case 'G':
+			shift += 10;
+			/* fall through */
+		case 'M':
+			shift += 10;
+			/* fall through */
+		case 'K':
+			shift += 10;
+			end++;
+			break;
+	}
+	if (*end != '\0' || size > (SIZE_MAX >> shift)) {
+		return 0;
+	}
+	return (size_t)size << shift;
+}
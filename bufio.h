@@ -0,0 +1,179 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <string.h>
+#include <endian.h>
+#include <sys/types.h>
+
+#ifndef BUFIOH
+#define BUFIOH
+#include "aio.h"
+
+/* Default number of bytes held by a reader or writer buffer */
+#define BUF_SIZE (1 << 18)
+/* Mappings at least this large are rounded up to a multiple of it so
+ * that the kernel can back them with transparent huge pages */
+#define HUGE_PAGE_SIZE (1 << 21)
+
+/* BufReader: Buffers reads from a file descriptor so that the hot loops
+ * can walk bytes in memory instead of making one syscall per byte. */
+typedef struct BufReader {
+	/* File descriptor being read from */
+	int fd;
+	/* Buffer holding bytes read from fd */
+	uint8_t *buf;
+	/* Capacity of buf */
+	size_t size;
+	/* Index of the next unread byte in buf */
+	size_t pos;
+	/* Number of valid bytes in buf */
+	size_t len;
+	/* Set once read has returned 0 */
+	int eof;
+	/* Set when buf already holds all of the input and is never
+	 * refilled, as for a mapped file or a block in memory */
+	int fixed;
+	/* Size of the mapping when buf is a memory mapped file, else 0 */
+	size_t mapped;
+	/* Reads the next buffer in the background, NULL if reads are made
+	 * as the buffer runs out. buf then has size bytes of room in front
+	 * of where reads land, for the unread bytes of the last buffer. */
+	AsyncIo *aio;
+} BufReader;
+
+/* BufWriter: Collects output bytes and writes them out in large chunks.
+ * A writer with no file descriptor keeps everything in memory, growing
+ * its buffer as needed. */
+typedef struct BufWriter {
+	/* File descriptor being written to, -1 for a memory writer */
+	int fd;
+	/* Buffer holding bytes not yet written */
+	uint8_t *buf;
+	/* Capacity of buf */
+	size_t size;
+	/* Number of bytes waiting in buf */
+	size_t len;
+	/* Writes full buffers in the background, NULL if they are written
+	 * as they fill */
+	AsyncIo *aio;
+} BufWriter;
+
+/* BitWriter: Packs codes into a 64 bit accumulator and hands whole
+ * words to a BufWriter, most significant bit first */
+typedef struct BitWriter {
+	/* Where completed words go */
+	BufWriter *out;
+	/* Pending bits, right aligned. Bits above nbits are ignored. */
+	uint64_t acc;
+	/* Number of pending bits in acc */
+	int nbits;
+} BitWriter;
+
+/* BitReader: Reads codes back out of a bitstream held in memory, most
+ * significant bit first. Past the end of the stream it reads zeros. */
+typedef struct BitReader {
+	/* Next byte not yet loaded into acc, and the end of the stream */
+	const uint8_t *pos;
+	const uint8_t *end;
+	/* Unconsumed bits, left aligned */
+	uint64_t acc;
+	/* Number of valid bits in acc */
+	int nbits;
+} BitReader;
+
+/* IoCounters: Syscalls made by readers and writers and the bytes they
+ * moved, reported by --stats */
+typedef struct IoCounters {
+	uint64_t read_calls;
+	uint64_t write_calls;
+	uint64_t map_calls;
+	uint64_t bytes_read;
+	uint64_t bytes_written;
+	uint64_t bytes_mapped;
+} IoCounters;
+
+extern IoCounters io_counters;
+
+void countCall(uint64_t *, uint64_t *, ssize_t);
+BufReader *makeReader(int, size_t);
+BufReader *makeAsyncReader(int, size_t);
+BufReader *mapReader(int, size_t);
+void initMemReader(BufReader *, const void *, size_t);
+BufReader *memReader(const void *, size_t);
+size_t readerFill(BufReader *);
+size_t readerPeek(BufReader *, size_t);
+size_t readerRead(BufReader *, void *, size_t);
+void readerRewind(BufReader *);
+void readerDestroy(BufReader *);
+BufWriter *makeWriter(int, size_t);
+BufWriter *makeAsyncWriter(int, size_t);
+BufWriter *makeMemWriter(size_t);
+void writerWrite(BufWriter *, const void *, size_t);
+void writerFlush(BufWriter *);
+void writerSync(BufWriter *);
+void writerDestroy(BufWriter *);
+void writeAt(int, const void *, size_t, off_t);
+uint8_t *mapOutput(BufWriter *, size_t);
+void unmapOutput(BufWriter *, uint8_t *, size_t);
+void initBitWriter(BitWriter *, BufWriter *);
+void initBitReader(BitReader *, const uint8_t *, size_t);
+void putWord(BitWriter *, uint64_t);
+void flushBits(BitWriter *);
+size_t parseSize(const char *);
+
+/* Returns the next byte from the reader or -1 once the input is used up */
+static inline int readerGetc(BufReader *in) {
+	if (in->pos == in->len && readerFill(in) == 0) {
+		return -1;
+	}
+	return in->buf[in->pos++];
+}
+
+/* Appends a single byte to the writer */
+static inline void writerPutc(BufWriter *out, uint8_t c) {
+	if (out->len == out->size) {
+		writerFlush(out);
+	}
+	out->buf[out->len++] = c;
+}
+
+/* Appends the low len bits of bits to the bit writer. Codes shorter
+ * than the free space are just shifted in; otherwise the accumulator is
+ * topped off and written out as a word. len must be at most 64 and bits
+ * must have nothing set above len. */
+static inline void putBits(BitWriter *bw, uint64_t bits, int len) {
+	int room = 64 - bw->nbits;
+	int rest;
+	if (len < room) {
+		bw->acc = (bw->acc << len) | bits;
+		bw->nbits += len;
+		return;
+	}
+	rest = len - room;
+	putWord(bw, (room == 64 ? 0 : bw->acc << room) | (bits >> rest));
+	bw->acc = bits;
+	bw->nbits = rest;
+}
+
+/* Tops up a bit reader that holds at most 56 valid bits to at least 57.
+ * Away from the end of the stream this is a single unaligned 8 byte
+ * load; the bytes it loads past the whole ones it counts are loaded
+ * again next time. */
+static inline void refillBits(BitReader *br) {
+	uint64_t word;
+	if (br->end - br->pos >= (ptrdiff_t)sizeof(uint64_t)) {
+		memcpy(&word, br->pos, sizeof(uint64_t));
+		br->acc |= be64toh(word) >> br->nbits;
+		br->pos += (63 - br->nbits) >> 3;
+		br->nbits |= 56;
+		return;
+	}
+	while (br->nbits <= 56) {
+		if (br->pos < br->end) {
+			br->acc |= (uint64_t)*br->pos++ << (56 - br->nbits);
+		}
+		br->nbits += 8;
+	}
+}
+#endif
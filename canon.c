@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "freq.h"
+#include "canon.h"
+
+/* Orders tree leaves by weight, then by ASCII value */
+static int leafCompare(const void *a, const void *b) {
+	const TreeNode *x = a, *y = b;
+	if (x->weight != y->weight) {
+		return x->weight < y->weight ? -1 : 1;
+	}
+	return x->symbol - y->symbol;
+}
+
+/* Builds the huffman tree for a frequency table into a flat node array
+ * with the two queue method. The leaves are sorted once by weight and
+ * every internal node is appended after them. Internal nodes are made
+ * in order of weight, so the leaves and the internal nodes form two
+ * sorted queues and the two lightest nodes are always at their fronts.
+ * Children always come before their parent and the root is last.
+ *
+ * Parameters:
+ *  freq_table - A pointer to a Frequency Table
+ *  tree - The tree to fill in
+ */
+void buildTreeArray(FrequencyTable *freq_table, HuffTree *tree) {
+	int i, n = 0;
+	/* Front of the leaf queue and of the internal node queue */
+	int leaf, inner;
+	int pick[2], k;
+	TreeNode *node;
+
+	for (i = 0; i < MAX_NUM_BYTES; i++) {
+		if (freq_table->freq[i] > 0) {
+			tree->nodes[n].weight = freq_table->freq[i];
+			tree->nodes[n].left = -1;
+			tree->nodes[n].right = -1;
+			tree->nodes[n].symbol = i;
+			n++;
+		}
+	}
+	qsort(tree->nodes, n, sizeof(TreeNode), leafCompare);
+	tree->nleaves = n;
+	tree->size = n;
+	leaf = 0;
+	inner = n;
+	while (tree->size < 2 * n - 1) {
+		for (k = 0; k < 2; k++) {
+			/* Take a leaf when it weighs no more than the next
+			 * internal node */
+			if (leaf < n && (inner == tree->size || 
+				tree->nodes[leaf].weight <= 
+				tree->nodes[inner].weight)) {
+				pick[k] = leaf++;
+			}
+			else {
+				pick[k] = inner++;
+			}
+		}
+		node = &tree->nodes[tree->size++];
+		node->weight = tree->nodes[pick[0]].weight + 
+			tree->nodes[pick[1]].weight;
+		node->left = pick[0];
+		node->right = pick[1];
+		node->symbol = -1;
+	}
+}
+
+/* Records the depth of every leaf of a tree as that character's code
+ * length. Parents come after their children in the array, so walking it
+ * from the root down sets each node's depth before its children's. A
+ * tree that is a single leaf leaves its character with a length of 0. */
+void treeLengths(const HuffTree *tree, uint8_t *lengths) {
+	uint8_t depth[2 * MAX_NUM_BYTES - 1];
+	const TreeNode *node;
+	int i;
+
+	if (tree->size == 0) {
+		return;
+	}
+	depth[tree->size - 1] = 0;
+	for (i = tree->size - 1; i >= 0; i--) {
+		node = &tree->nodes[i];
+		if (node->left == -1) {
+			lengths[node->symbol] = depth[i];
+		}
+		else {
+			depth[node->left] = depth[i] + 1;
+			depth[node->right] = depth[i] + 1;
+		}
+	}
+}
+
+/* Assigns canonical codes from code lengths. Codes are handed out in
+ * order of length and then ASCII value, each one being the previous
+ * code plus one, shifted left whenever the length grows. Only the
+ * lengths are then needed to get the same codes back.
+ *
+ * Parameters:
+ *  lengths - Code length of each of the 256 characters, 0 if absent
+ *  codes - Array of 256 codes that gets filled in
+ */
+void canonCodes(const uint8_t *lengths, Code *codes) {
+	int i;
+	/* Number of codes of each length */
+	unsigned int len_count[MAX_CODE_LEN + 1] = {0};
+	/* Next code to hand out for each length */
+	uint64_t next_code[MAX_CODE_LEN + 1];
+	uint64_t code = 0;
+
+	for (i = 0; i < MAX_NUM_BYTES; i++) {
+		len_count[lengths[i]] += 1;
+	}
+	len_count[0] = 0;
+	for (i = 1; i <= MAX_CODE_LEN; i++) {
+		code = (code + len_count[i - 1]) << 1;
+		next_code[i] = code;
+	}
+	for (i = 0; i < MAX_NUM_BYTES; i++) {
+		codes[i].len = lengths[i];
+		if (lengths[i] > 0) {
+			codes[i].bits = next_code[lengths[i]]++;
+		}
+		else {
+			codes[i].bits = 0;
+		}
+	}
+}
+
+/* Checks that code lengths read from a header describe a complete
+ * prefix code over at least two characters, so that every bit pattern
+ * decodes to exactly one character. Returns 0 if they do, -1 if not. */
+int checkLengths(const uint8_t *lengths) {
+	int i;
+	unsigned int len_count[MAX_CODE_LEN + 1] = {0};
+	/* Number of codes still available at the current length */
+	uint64_t left = 1;
+
+	for (i = 0; i < MAX_NUM_BYTES; i++) {
+		if (lengths[i] > MAX_CODE_LEN) {
+			return -1;
+		}
+		len_count[lengths[i]] += 1;
+	}
+	for (i = 1; i <= MAX_CODE_LEN; i++) {
+		left <<= 1;
+		if (left < len_count[i]) {
+			return -1;
+		}
+		left -= len_count[i];
+		/* More room than there are characters left to place */
+		if (left > 2 * MAX_NUM_BYTES) {
+			left = 2 * MAX_NUM_BYTES;
+		}
+	}
+	return left == 0 ? 0 : -1;
+}
+
+/* Replaces the code lengths of a tree with the optimal lengths that
+ * are no longer than limit, using the package-merge algorithm. The
+ * leaves are coins whose value is their weight. The list for the
+ * deepest level holds the leaves alone; each level above it merges the
+ * leaves with packages of two consecutive items of the level below. The
+ * 2n - 2 cheapest items of the top list are then picked. Picking a
+ * leaf at a level adds one to its length, and picking a package picks
+ * both of its items at the level below. Leaves always sit in a list in
+ * order of weight, so the leaves picked at a level are the lightest
+ * ones and only the number of leaves in each prefix needs keeping.
+ *
+ * Parameters:
+ *  tree - A tree built by buildTreeArray with at least two leaves
+ *  lengths - Code length of each character, filled in
+ *  limit - Longest code allowed. 2^limit must be at least the number
+ *          of leaves.
+ */
+static void limitLengths(const HuffTree *tree, uint8_t *lengths, int limit) {
+	int n = tree->nleaves;
+	/* Weights of the list being built and of the one below it */
+	uint64_t prev[2 * MAX_NUM_BYTES], cur[2 * MAX_NUM_BYTES];
+	/* is_leaf[level][i]: whether item i of a level's list is a leaf.
+	 * At 33K it fits on any thread's stack, so nothing is allocated and
+	 * nothing can fail. */
+	uint8_t is_leaf[MAX_CODE_LEN + 1][2 * MAX_NUM_BYTES];
+	int count[MAX_CODE_LEN + 1];
+	int level, i, leaf, pkg, npkg, len, picked, nleaf;
+
+	/* The deepest level: the leaves alone */
+	for (i = 0; i < n; i++) {
+		prev[i] = tree->nodes[i].weight;
+		is_leaf[limit][i] = 1;
+	}
+	count[limit] = n;
+	for (level = limit - 1; level >= 1; level--) {
+		npkg = count[level + 1] / 2;
+		leaf = 0;
+		pkg = 0;
+		len = 0;
+		while (leaf < n || pkg < npkg) {
+			/* Leaves go first when they tie with a package */
+			if (pkg == npkg || (leaf < n && tree->nodes[leaf].weight
+				<= prev[2 * pkg] + prev[2 * pkg + 1])) {
+				cur[len] = tree->nodes[leaf++].weight;
+				is_leaf[level][len++] = 1;
+			}
+			else {
+				cur[len] = prev[2 * pkg] + prev[2 * pkg + 1];
+				pkg += 1;
+				is_leaf[level][len++] = 0;
+			}
+		}
+		count[level] = len;
+		memcpy(prev, cur, len * sizeof(uint64_t));
+	}
+
+	for (i = 0; i < n; i++) {
+		lengths[tree->nodes[i].symbol] = 0;
+	}
+	picked = 2 * n - 2;
+	for (level = 1; level <= limit && picked > 0; level++) {
+		nleaf = 0;
+		for (i = 0; i < picked; i++) {
+			nleaf += is_leaf[level][i];
+		}
+		for (i = 0; i < nleaf; i++) {
+			lengths[tree->nodes[i].symbol] += 1;
+		}
+		picked = 2 * (picked - nleaf);
+	}
+}
+
+/* Builds the huffman tree for a frequency table and keeps the depth of
+ * each char. as its code length. The tree and the package-merge lists
+ * live on the stack, so nothing is allocated.
+ *
+ * Parameters:
+ *  freq_table - A pointer to a Frequency Table
+ *  limit - Longest code allowed, 0 for MAX_CODE_LEN. Must be at least
+ *          MIN_CODE_LIMIT.
+ */
+void makeLengths(FrequencyTable *freq_table, int limit) {
+	HuffTree tree;
+	int i, max_len = 0;
+
+	/* Counts near 2^64 can make a tree deeper than codes can be held
+	 * in, so there is always a limit */
+	if (limit == 0) {
+		limit = MAX_CODE_LEN;
+	}
+	buildTreeArray(freq_table, &tree);
+	treeLengths(&tree, freq_table->lengths);
+	for (i = 0; i < MAX_NUM_BYTES; i++) {
+		if (freq_table->lengths[i] > max_len) {
+			max_len = freq_table->lengths[i];
+		}
+	}
+	/* Only trees that are too deep pay for package-merge */
+	if (limit > 0 && max_len > limit) {
+		limitLengths(&tree, freq_table->lengths, limit);
+	}
+}
+
+/* Gives each char. of a frequency table its code length and assigns
+ * canonical codes from those lengths. See makeLengths for limit. */
+void makeCodes(FrequencyTable *freq_table, int limit) {
+	makeLengths(freq_table, limit);
+	canonCodes(freq_table->lengths, freq_table->codes);
+}
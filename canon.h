@@ -0,0 +1,42 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifndef CANONH
+#define CANONH
+#include "freq.h"
+
+/* Longest code that fits in the 64 bit code values */
+#define MAX_CODE_LEN 64
+/* Smallest code length limit, enough for codes for all 256 chars. */
+#define MIN_CODE_LIMIT 8
+
+/* TreeNode: A node of a huffman tree kept in an array. Children are
+ * referred to by their index in the array. */
+typedef struct TreeNode {
+	/* Sum of the frequencies of the chars. below the node */
+	uint64_t weight;
+	/* Indexes of the children, -1 for a leaf */
+	int16_t left;
+	int16_t right;
+	/* ASCII value of a leaf, -1 for an internal node */
+	int16_t symbol;
+} TreeNode;
+
+/* HuffTree: A whole huffman tree in one flat array. The leaves come
+ * first, sorted by weight, followed by the internal nodes with the root
+ * last. */
+typedef struct HuffTree {
+	TreeNode nodes[2 * MAX_NUM_BYTES - 1];
+	/* Number of leaves */
+	int nleaves;
+	/* Number of nodes in use */
+	int size;
+} HuffTree;
+
+void buildTreeArray(FrequencyTable *, HuffTree *);
+void treeLengths(const HuffTree *, uint8_t *);
+void canonCodes(const uint8_t *, Code *);
+int checkLengths(const uint8_t *);
+void makeLengths(FrequencyTable *, int);
+void makeCodes(FrequencyTable *, int);
+#endif
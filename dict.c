@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include "freq.h"
+#include "bufio.h"
+#include "canon.h"
+#include "filerw.h"
+#include "dict.h"
+
+/* Returns the FNV-1a hash of a table's code lengths, used as its id */
+static uint32_t hashLengths(const uint8_t *lengths) {
+	uint32_t hash = 2166136261u;
+	int i;
+	for (i = 0; i < MAX_NUM_BYTES; i++) {
+		hash ^= lengths[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/* Fills in the codes, longest code and id of a table from its lengths */
+static void finishDict(Dictionary *dict) {
+	int i;
+	canonCodes(dict->lengths, dict->codes);
+	dict->max_len = 0;
+	for (i = 0; i < MAX_NUM_BYTES; i++) {
+		if (dict->lengths[i] > dict->max_len) {
+			dict->max_len = dict->lengths[i];
+		}
+	}
+	dict->id = hashLengths(dict->lengths);
+}
+
+/* Builds a table from the char. frequencies of a sample corpus. Chars.
+ * missing from the samples are counted once, so that every char. gets
+ * a code and no input is ever left unencodable.
+ *
+ * Parameters:
+ *  freq_table - Frequencies summed over the samples. Changed by the
+ *               missing chars. being added.
+ *  limit - Longest code allowed, 0 for no limit
+ *  dict - The table that gets filled in
+ */
+void trainDict(FrequencyTable *freq_table, int limit, Dictionary *dict) {
+	int c;
+	for (c = 0; c < MAX_NUM_BYTES; c++) {
+		if (freq_table->freq[c] == 0) {
+			freq_table->freq[c] = 1;
+			freq_table->count += 1;
+		}
+	}
+	freq_table->unique_count = MAX_NUM_BYTES;
+	makeLengths(freq_table, limit);
+	memcpy(dict->lengths, freq_table->lengths, MAX_NUM_BYTES);
+	finishDict(dict);
+}
+
+/* Writes a table file: the magic bytes, the table id, 4 bytes in
+ * network byte order, and the code length of each of the 256 chars. */
+void writeDict(BufWriter *out, Dictionary *dict) {
+	uint32_t id = htonl(dict->id);
+	writerWrite(out, DICT_MAGIC, MAGIC_LEN);
+	writerWrite(out, &id, sizeof(uint32_t));
+	writerWrite(out, dict->lengths, MAX_NUM_BYTES);
+}
+
+/* Reads a table written by writeDict. Returns 0 on success or -1 if it
+ * is cut short, its lengths don't give every char. a code, or they
+ * don't match its id. */
+int readDict(BufReader *in, Dictionary *dict) {
+	uint8_t magic[MAGIC_LEN];
+	uint32_t id;
+	int c;
+
+	if (readerRead(in, magic, MAGIC_LEN) != MAGIC_LEN
+		|| memcmp(magic, DICT_MAGIC, MAGIC_LEN) != 0
+		|| readerRead(in, &id, sizeof(uint32_t)) != sizeof(uint32_t)
+		|| readerRead(in, dict->lengths, MAX_NUM_BYTES)
+			!= MAX_NUM_BYTES
+		|| checkLengths(dict->lengths) == -1) {
+		return -1;
+	}
+	for (c = 0; c < MAX_NUM_BYTES; c++) {
+		if (dict->lengths[c] == 0) {
+			return -1;
+		}
+	}
+	finishDict(dict);
+	return dict->id == ntohl(id) ? 0 : -1;
+}
+
+/* Reads a table file given to -D. Exits if it can't be opened or is not
+ * a valid table. */
+Dictionary *loadDict(const char *path) {
+	Dictionary *dict;
+	BufReader *in;
+	int fd = open(path, O_RDONLY);
+
+	if (fd == -1) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	dict = malloc(sizeof(Dictionary));
+	if (!dict) {
+		perror("malloc Dictionary");
+		exit(EXIT_FAILURE);
+	}
+	in = makeReader(fd, BUF_SIZE);
+	if (readDict(in, dict) == -1) {
+		fprintf(stderr, "%s: not a valid table file\n", path);
+		exit(EXIT_FAILURE);
+	}
+	readerDestroy(in);
+	close(fd);
+	return dict;
+}
+
+/* Writes the header of a file coded with a table: the magic bytes, the
+ * format version (VERSION_DICT), the table id, 4 bytes in network byte
+ * order, and the number of chars. as a varint. No code lengths are
+ * written; the decoder gets them from the same table.
+ *
+ * Parameters:
+ *  out - A buffered writer for the output file
+ *  dict - The table the body is coded with
+ *  count - The number of chars. in the body
+ */
+void makeDictHeader(BufWriter *out, Dictionary *dict, uint64_t count) {
+	uint32_t id = htonl(dict->id);
+	writerWrite(out, HUFF_MAGIC, MAGIC_LEN);
+	writerPutc(out, VERSION_DICT);
+	writerWrite(out, &id, sizeof(uint32_t));
+	putVarint(out, count);
+}
+
+/* Reads the table id and count that follow the version byte of a
+ * VERSION_DICT file, and fills in the frequency table's count and code
+ * lengths from the table. Returns 0 on success, -1 if the header is cut
+ * short, or DICT_MISMATCH if the file was written with another table. */
+int readDictHeader(BufReader *in, Dictionary *dict,
+		FrequencyTable *freq_table) {
+	uint32_t id;
+
+	if (readerRead(in, &id, sizeof(uint32_t)) != sizeof(uint32_t)) {
+		return -1;
+	}
+	if (ntohl(id) != dict->id) {
+		return DICT_MISMATCH;
+	}
+	if (getVarint(in, &freq_table->count) == -1) {
+		return -1;
+	}
+	memcpy(freq_table->lengths, dict->lengths, MAX_NUM_BYTES);
+	freq_table->unique_count = MAX_NUM_BYTES;
+	return 0;
+}
@@ -0,0 +1,34 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifndef DICTH
+#define DICTH
+#include "freq.h"
+#include "bufio.h"
+
+/* Magic bytes at the start of a table file written by htrain */
+#define DICT_MAGIC "HUT"
+/* Returned by readDictHeader when a file was written with another table */
+#define DICT_MISMATCH -2
+
+/* Dictionary: A code trained ahead of time on sample data. Every char.
+ * has a code, so any input can be written with it, and files written
+ * with it carry only the table's id instead of code lengths. */
+typedef struct Dictionary {
+	/* Hash of the code lengths, stored in every file using the table */
+	uint32_t id;
+	/* Length in bits of each character's code */
+	uint8_t lengths[MAX_NUM_BYTES];
+	/* Each character's canonical code, indexed by ASCII value */
+	Code codes[MAX_NUM_BYTES];
+	/* Longest code */
+	unsigned int max_len;
+} Dictionary;
+
+void trainDict(FrequencyTable *, int, Dictionary *);
+void writeDict(BufWriter *, Dictionary *);
+int readDict(BufReader *, Dictionary *);
+Dictionary *loadDict(const char *);
+void makeDictHeader(BufWriter *, Dictionary *, uint64_t);
+int readDictHeader(BufReader *, Dictionary *, FrequencyTable *);
+#endif
@@ -0,0 +1,304 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "freq.h"
+#include "canon.h"
+#include "dtable.h"
+
+/* Returned by dtableAlloc when the table can't be grown */
+#define DT_NOMEM ((size_t)-1)
+
+/* Returns the depth of the deepest leaf below a node */
+static int treeDepth(Node *tree) {
+	int left, right;
+	if (!(tree->left && tree->right)) {
+		return 0;
+	}
+	left = treeDepth(tree->left);
+	right = treeDepth(tree->right);
+	return 1 + (left > right ? left : right);
+}
+
+/* Reserves n slots at the end of the table and returns the index of the
+ * first one, or DT_NOMEM if the table can't be grown, in which case it
+ * is left as it was. New slots start out decoding to character 0 with
+ * no bits used, so a slot that is never filled can't send decoding
+ * astray. */
+static size_t dtableAlloc(DecodeTable *table, size_t n) {
+	size_t first = table->size;
+	size_t cap = table->cap;
+	DecodeEntry *entries;
+
+	while (table->size + n > cap) {
+		cap *= 2;
+	}
+	if (cap != table->cap) {
+		entries = realloc(table->entries, cap * sizeof(DecodeEntry));
+		if (!entries) {
+			return DT_NOMEM;
+		}
+		table->entries = entries;
+		table->cap = cap;
+	}
+	memset(table->entries + first, 0, n * sizeof(DecodeEntry));
+	table->size += n;
+	return first;
+}
+
+/* Fills the slots of the table starting at base that are reached
+ * through a node.
+ *
+ * Parameters:
+ *  table - The decode table being built
+ *  base - Index of the first slot of the (sub-)table being filled
+ *  bits - Number of bits that index the (sub-)table
+ *  tree - The node reached after depth bits of the (sub-)table
+ *  depth - Number of bits between the top of the (sub-)table and tree
+ *  prefix - The bits that lead to tree
+ *
+ * Returns 0, or -1 if a sub-table can't be allocated.
+ */
+static int fillTable(DecodeTable *table, size_t base, int bits,
+			Node *tree, int depth, uint32_t prefix) {
+	size_t i, first, span;
+	size_t sub;
+	int sub_bits;
+
+	/* Leaf: every slot whose top depth bits are prefix decodes to it */
+	if (!(tree->left && tree->right)) {
+		span = (size_t)1 << (bits - depth);
+		first = base + ((size_t)prefix << (bits - depth));
+		for (i = 0; i < span; i++) {
+			table->entries[first + i].value = tree->ascii;
+			table->entries[first + i].len = depth;
+			table->entries[first + i].link = 0;
+		}
+		return 0;
+	}
+	/* Out of bits in this table, so the rest of the subtree gets its
+	 * own table, sized to the subtree but no bigger than DT_BITS */
+	if (depth == bits) {
+		sub_bits = treeDepth(tree);
+		if (sub_bits > DT_BITS) {
+			sub_bits = DT_BITS;
+		}
+		sub = dtableAlloc(table, (size_t)1 << sub_bits);
+		if (sub == DT_NOMEM) {
+			return -1;
+		}
+		table->entries[base + prefix].value = sub;
+		table->entries[base + prefix].len = sub_bits;
+		table->entries[base + prefix].link = 1;
+		return fillTable(table, sub, sub_bits, tree, 0, 0);
+	}
+	if (fillTable(table, base, bits, tree->left, depth + 1,
+			prefix << 1) == -1) {
+		return -1;
+	}
+	return fillTable(table, base, bits, tree->right, depth + 1,
+			(prefix << 1) | 1);
+}
+
+/* Allocates an empty decode table whose primary table has the given
+ * number of index bits. Returns NULL if it can't be allocated. */
+static DecodeTable *newTable(int bits) {
+	DecodeTable *table = malloc(sizeof(DecodeTable));
+	if (!table) {
+		return NULL;
+	}
+	table->bits = bits;
+	table->size = 0;
+	table->cap = (size_t)1 << bits;
+	table->entries = malloc(table->cap * sizeof(DecodeEntry));
+	if (!table->entries) {
+		free(table);
+		return NULL;
+	}
+	dtableAlloc(table, (size_t)1 << bits);
+	return table;
+}
+
+/* Returns the top bits of a character's code once the first shift bits
+ * have been dropped */
+static uint64_t codeIndex(const Code *codes, int c, int shift, int bits) {
+	uint64_t aligned = codes[c].bits << (64 - codes[c].len);
+	return (aligned << shift) >> (64 - bits);
+}
+
+/* Fills the slots of the table starting at base for a run of characters
+ * whose codes agree on the first shift bits.
+ *
+ * Parameters:
+ *  table - The decode table being built
+ *  base - Index of the first slot of the (sub-)table being filled
+ *  bits - Number of bits that index the (sub-)table
+ *  syms - The characters, in ascending order of left aligned code
+ *  n - The number of characters in syms
+ *  codes - Code of each character
+ *  shift - Number of code bits resolved by the parent tables
+ *
+ * Returns 0, or -1 if a sub-table can't be allocated.
+ */
+static int fillCodes(DecodeTable *table, size_t base, int bits,
+			const uint8_t *syms, int n, const Code *codes, 
+			int shift) {
+	int i = 0, j;
+	int rest, max_rest, sub_bits;
+	uint64_t index;
+	size_t k, span, first, sub;
+
+	while (i < n) {
+		index = codeIndex(codes, syms[i], shift, bits);
+		rest = codes[syms[i]].len - shift;
+		/* Code ends in this table. Every slot it prefixes maps to it */
+		if (rest <= bits) {
+			span = (size_t)1 << (bits - rest);
+			first = base + index;
+			for (k = 0; k < span; k++) {
+				table->entries[first + k].value = syms[i];
+				table->entries[first + k].len = rest;
+				table->entries[first + k].link = 0;
+			}
+			i += 1;
+			continue;
+		}
+		/* Codes that run past this table share a slot per prefix. 
+		 * They are next to each other in syms, so gather them and
+		 * give them a sub-table sized for the longest one. */
+		max_rest = 0;
+		for (j = i; j < n; j++) {
+			if (codeIndex(codes, syms[j], shift, bits) != index) {
+				break;
+			}
+			if (codes[syms[j]].len - shift - bits > max_rest) {
+				max_rest = codes[syms[j]].len - shift - bits;
+			}
+		}
+		sub_bits = max_rest > DT_BITS ? DT_BITS : max_rest;
+		sub = dtableAlloc(table, (size_t)1 << sub_bits);
+		if (sub == DT_NOMEM) {
+			return -1;
+		}
+		table->entries[base + index].value = sub;
+		table->entries[base + index].len = sub_bits;
+		table->entries[base + index].link = 1;
+		if (fillCodes(table, sub, sub_bits, syms + i, j - i, codes,
+				shift + bits) == -1) {
+			return -1;
+		}
+		i = j;
+	}
+	return 0;
+}
+
+/* Rebuilds a decode table in place from canonical code lengths, without
+ * building a tree. The table's slots are reused, so a table that is
+ * loaded over and over only allocates when it needs more slots than
+ * ever before. The lengths must have passed checkLengths. Returns 0, or
+ * -1 if the table needs more slots and can't be grown, in which case it
+ * must be loaded again before it is used. */
+int loadCanonTable(DecodeTable *table, const uint8_t *lengths) {
+	Code codes[MAX_NUM_BYTES];
+	/* Characters in order of length and then ASCII value, which is the
+	 * order of their left aligned canonical codes */
+	uint8_t syms[MAX_NUM_BYTES];
+	int n = 0, len, c;
+	int max_len = 0;
+
+	for (c = 0; c < MAX_NUM_BYTES; c++) {
+		if (lengths[c] > max_len) {
+			max_len = lengths[c];
+		}
+	}
+	for (len = 1; len <= max_len; len++) {
+		for (c = 0; c < MAX_NUM_BYTES; c++) {
+			if (lengths[c] == len) {
+				syms[n++] = c;
+			}
+		}
+	}
+	canonCodes(lengths, codes);
+	table->bits = max_len > DT_BITS ? DT_BITS : max_len;
+	table->size = 0;
+	if (dtableAlloc(table, (size_t)1 << table->bits) == DT_NOMEM) {
+		return -1;
+	}
+	return fillCodes(table, 0, table->bits, syms, n, codes, 0);
+}
+
+/* Builds a decode table straight from canonical code lengths, without
+ * building a tree. The lengths must have passed checkLengths. Returns
+ * NULL if the table can't be allocated. */
+DecodeTable *makeCanonTable(const uint8_t *lengths) {
+	DecodeTable *table = newTable(0);
+	if (table && loadCanonTable(table, lengths) == -1) {
+		dtableDestroy(table);
+		return NULL;
+	}
+	return table;
+}
+
+/* Builds a decode table for a file made of a single repeated character.
+ * Every symbol decodes to it without using up any bits. Returns NULL if
+ * the table can't be allocated. */
+DecodeTable *makeSingleTable(int ascii) {
+	DecodeTable *table = newTable(0);
+	if (table) {
+		table->entries[0].value = ascii;
+	}
+	return table;
+}
+
+/* Rebuilds a decode table in place for the code lengths and count that
+ * readLengths put into a frequency table, the way loadCanonTable does.
+ * Returns 0, or -1 if the table can't be grown. */
+int loadLengthsTable(DecodeTable *table, FrequencyTable *freq_table) {
+	int c = 0;
+	/* A stored body is copied without looking at the table, and a
+	 * single repeated character has no body. Either way every symbol
+	 * decodes to one char. without using up any bits. */
+	if (freq_table->stored || freq_table->unique_count == 1) {
+		while (!freq_table->stored && freq_table->freq[c] == 0) {
+			c++;
+		}
+		table->bits = 0;
+		table->size = 0;
+		dtableAlloc(table, 1);
+		table->entries[0].value = c;
+		return 0;
+	}
+	/* Canonical codes, the table comes straight from the lengths */
+	return loadCanonTable(table, freq_table->lengths);
+}
+
+/* Builds the decode table for the code lengths and count that 
+ * readLengths put into a frequency table. Returns NULL if the table
+ * can't be allocated. */
+DecodeTable *makeLengthsTable(FrequencyTable *freq_table) {
+	DecodeTable *table = newTable(0);
+	if (table && loadLengthsTable(table, freq_table) == -1) {
+		dtableDestroy(table);
+		return NULL;
+	}
+	return table;
+}
+
+/* Builds a decode table from a huffman tree. The primary table resolves
+ * up to DT_BITS bits per probe; longer codes continue in sub-tables.
+ * Returns NULL if the table can't be allocated. */
+DecodeTable *makeDecodeTable(Node *tree) {
+	int depth = treeDepth(tree);
+	DecodeTable *table = newTable(depth > DT_BITS ? DT_BITS : depth);
+	if (table && fillTable(table, 0, table->bits, tree, 0, 0) == -1) {
+		dtableDestroy(table);
+		return NULL;
+	}
+	return table;
+}
+
+/* Frees a decode table */
+void dtableDestroy(DecodeTable *table) {
+	free(table->entries);
+	free(table);
+}
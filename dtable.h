@@ -0,0 +1,46 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifndef DTABLEH
+#define DTABLEH
+#include "freq.h"
+#include "llist.h"
+
+/* Number of bits resolved by one probe of the primary decode table */
+#define DT_BITS 11
+
+/* DecodeEntry: One slot of a decode table. A slot either names a symbol
+ * or links to a sub-table that resolves the bits after it. */
+typedef struct DecodeEntry {
+	/* The symbol for a leaf slot, or the index of the first slot of
+	 * the sub-table for a link slot */
+	uint32_t value;
+	/* Bits used up by a leaf slot, or the number of bits that index
+	 * the linked sub-table */
+	uint8_t len;
+	/* Non-zero if the slot links to a sub-table */
+	uint8_t link;
+} DecodeEntry;
+
+/* DecodeTable: The primary table followed by all of its sub-tables in a
+ * single array, so decoding touches a few cache lines instead of a
+ * pointer per bit. */
+typedef struct DecodeTable {
+	/* Primary table at index 0, sub-tables after it */
+	DecodeEntry *entries;
+	/* Number of slots in use */
+	size_t size;
+	/* Number of slots allocated */
+	size_t cap;
+	/* Number of bits that index the primary table */
+	int bits;
+} DecodeTable;
+
+DecodeTable *makeDecodeTable(Node *);
+int loadCanonTable(DecodeTable *, const uint8_t *);
+DecodeTable *makeCanonTable(const uint8_t *);
+DecodeTable *makeSingleTable(int);
+int loadLengthsTable(DecodeTable *, FrequencyTable *);
+DecodeTable *makeLengthsTable(FrequencyTable *);
+void dtableDestroy(DecodeTable *);
+#endif
@@ -4,180 +4,785 @@
 #include <arpa/inet.h>
 #include "freq.h"
 #include "llist.h"
+#include "bufio.h"
+#include "dtable.h"
+#include "canon.h"
+#include "filerw.h"
 
 /* Number of bits in a byte */
 #define BYTE_SIZE 8
-/* Number of bits to go from four bytes to one byte */
-#define FOUR_TO_ONE 24
 
-/* Writes the header to an output file. The header contains the 
- * frequencies of each char. that appears in the input file so that
- * the tree can be re-created. 
+/* Writes a value as a varint: 7 bits per byte, lowest bits first, with
+ * the top bit of every byte but the last set. Values below 128 take a
+ * single byte and no value takes more than VARINT_MAX bytes. */
+void putVarint(BufWriter *out, uint64_t value) {
+	while (value >= 0x80) {
+		writerPutc(out, (value & 0x7f) | 0x80);
+		value >>= 7;
+	}
+	writerPutc(out, value);
+}
+
+/* Reads a varint written by putVarint. Returns 0 on success or -1 if it
+ * is cut short or too long for 64 bits. */
+int getVarint(BufReader *in, uint64_t *value) {
+	int c, shift;
+	*value = 0;
+	for (shift = 0; shift < 7 * VARINT_MAX; shift += 7) {
+		if ((c = readerGetc(in)) == -1) {
+			return -1;
+		}
+		/* The tenth byte only has room for the top bit */
+		if (shift == 63 && c > 1) {
+			return -1;
+		}
+		*value |= (uint64_t)(c & 0x7f) << shift;
+		if (!(c & 0x80)) {
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* Picks how a body is written once its code lengths are known, from the
+ * size the codes would give it. A body of one repeated char. needs no
+ * bits at all (MODE_RUN), which the lengths already say. Otherwise the
+ * body is stored as it is when the codes and their lengths would take
+ * at least as many bytes as the chars. themselves, which is the case
+ * for random or already compressed data. Sets freq_table->stored.
  *
- * Paramters:
- *  fdout - A file descriptor for the output file 
- *  freq_table - A pointer to a Frequency Table 
+ * Parameters:
+ *  freq_table - A pointer to a Frequency Table with lengths filled in
+ */
+void chooseMode(FrequencyTable *freq_table) {
+	int i, lo = -1, hi = 0, max_len = 0;
+	uint64_t bits = 0, lengths;
+
+	freq_table->stored = 0;
+	if (freq_table->unique_count <= 1) {
+		return;
+	}
+	for (i = 0; i < MAX_NUM_BYTES; i++) {
+		if (freq_table->freq[i] > 0) {
+			if (lo == -1) {
+				lo = i;
+			}
+			hi = i;
+			bits += freq_table->freq[i] * freq_table->lengths[i];
+		}
+		if (freq_table->lengths[i] > max_len) {
+			max_len = freq_table->lengths[i];
+		}
+	}
+	/* Bytes of lengths after max_len, lo and hi, see writeCodeLengths */
+	lengths = max_len <= NIBBLE_MAX ? (hi - lo + 2) / 2 : hi - lo + 1;
+	/* A stored body only has its mode byte ahead of it, two bytes less
+	 * than max_len, lo and hi */
+	freq_table->stored = 2 + lengths + (bits + 7) / 8 
+				>= freq_table->count;
+}
+
+/* Writes the canonical code length of each char. so that the codes can
+ * be re-created without the frequencies or the tree.
+ *
+ * Layout:
+ *  - max_len: the longest code length, 1 byte. MODE_RUN (0) means the
+ *    file is a single repeated char. and no lengths follow. MODE_STORED
+ *    means the body is the chars. themselves and nothing else follows.
+ *  - lo, hi: the smallest and largest char. present, 1 byte each
+ *  - The code length of every char. from lo to hi, 0 for chars. that
+ *    don't appear. Two lengths are packed per byte, high nibble first,
+ *    when max_len fits in 4 bits, otherwise one length per byte.
  */
-void makeHeader(int fdout, FrequencyTable *freq_table) {
+static void writeCodeLengths(BufWriter *out, FrequencyTable *freq_table) {
 	int i;
-	/* represents number of unique words  - 1 */
-	uint8_t num = freq_table->unique_count - 1;
-	/* The ascii of a character */
-	uint8_t c;
-	/* The frequency corresponding to a character */
-	uint32_t freq;
+	/* Smallest and largest char. present and the longest code */
+	int lo = -1, hi = 0, max_len = 0;
+	uint8_t packed;
 
-	/* First write num - 1 */
-	/* Convert num to network byte order */
-	/* htonl returns a 32 bit number so need to convert num back to
-	 * 8 bits. This is done by right shifting by 24 which moves the
-	 * bits into positions 0-7. */
-	num = (uint8_t)(htonl(num) >> FOUR_TO_ONE);
-	write(fdout, &num, sizeof(uint8_t));
-	/* Then, write each char and frequency */
+	if (freq_table->stored) {
+		writerPutc(out, MODE_STORED);
+		return;
+	}
 	for (i = 0; i < freq_table->size; i++) {
 		if (freq_table->freq[i] > 0) {
-			c = i;
-			freq = freq_table->freq[i];
-			/* Convert to network byte order */
-			freq = htonl(freq);
-			/* Convert c back to 8 bits */
-			c = (uint8_t)(htonl(c) >> FOUR_TO_ONE);
-			write(fdout, &c, sizeof(uint8_t));
-			write(fdout, &freq, sizeof(uint32_t));
+			if (lo == -1) {
+				lo = i;
+			}
+			hi = i;
+		}
+		if (freq_table->lengths[i] > max_len) {
+			max_len = freq_table->lengths[i];
+		}
+	}
+
+	writerPutc(out, max_len);
+	writerPutc(out, lo);
+	writerPutc(out, hi);
+	/* A single repeated char. is fully described by lo */
+	if (max_len == 0) {
+		return;
+	}
+	if (max_len <= NIBBLE_MAX) {
+		for (i = lo; i <= hi; i += 2) {
+			packed = freq_table->lengths[i] << 4;
+			if (i + 1 <= hi) {
+				packed |= freq_table->lengths[i + 1];
+			}
+			writerPutc(out, packed);
+		}
+	}
+	else {
+		for (i = lo; i <= hi; i++) {
+			writerPutc(out, freq_table->lengths[i]);
+		}
+	}
+}
+
+/* Writes the number of chars., 4 bytes in network byte order, followed
+ * by the code lengths. This starts each block of a blocked file, whose
+ * blocks never hold more than MAX_BLOCK_SIZE chars.
+ *
+ * Paramters:
+ *  out - A buffered writer for the output file 
+ *  freq_table - A pointer to a Frequency Table with lengths filled in
+ */
+void writeLengths(BufWriter *out, FrequencyTable *freq_table) {
+	/* Convert to network byte order */
+	uint32_t count = htonl(freq_table->count);
+	writerWrite(out, &count, sizeof(uint32_t));
+	writeCodeLengths(out, freq_table);
+}
+
+/* Writes the header to an output file: the magic bytes, the format
+ * version (VERSION_WIDE), the number of chars. as a varint and then the
+ * code lengths.
+ *
+ * Paramters:
+ *  out - A buffered writer for the output file 
+ *  freq_table - A pointer to a Frequency Table with lengths filled in
+ */
+void makeHeader(BufWriter *out, FrequencyTable *freq_table) {
+	writerWrite(out, HUFF_MAGIC, MAGIC_LEN);
+	writerPutc(out, VERSION_WIDE);
+	putVarint(out, freq_table->count);
+	writeCodeLengths(out, freq_table);
+}
+
+/* Reads the code lengths written by writeCodeLengths into the frequency
+ * table, whose count must already be set. Returns 0 on success or -1 if
+ * they are cut short or describe an invalid code. */
+static int readCodeLengths(BufReader *in, FrequencyTable *freq_table) {
+	int i, c = 0;
+	uint8_t fields[2];
+	int max_len, lo, hi;
+
+	if ((max_len = readerGetc(in)) == -1) {
+		return -1;
+	}
+	if (max_len == MODE_STORED) {
+		freq_table->stored = 1;
+		return 0;
+	}
+	if (readerRead(in, fields, sizeof(fields)) != sizeof(fields)) {
+		return -1;
+	}
+	lo = fields[0];
+	hi = fields[1];
+	if (lo > hi || max_len > MAX_CODE_LEN) {
+		return -1;
+	}
+	/* Single repeated char. It gets a frequency so that unique_count
+	 * and freq describe it, but no code length. */
+	if (max_len == MODE_RUN) {
+		freq_table->freq[lo] = freq_table->count;
+		freq_table->unique_count = 1;
+		return 0;
+	}
+	for (i = lo; i <= hi; i++) {
+		if (max_len <= NIBBLE_MAX) {
+			/* Two lengths per byte, high nibble first */
+			if ((i - lo) % 2 == 0 && (c = readerGetc(in)) == -1) {
+				return -1;
+			}
+			freq_table->lengths[i] = (i - lo) % 2 == 0 ? 
+							c >> 4 : c & 0xf;
+		}
+		else {
+			if ((c = readerGetc(in)) == -1) {
+				return -1;
+			}
+			freq_table->lengths[i] = c;
+		}
+		if (freq_table->lengths[i] > 0) {
+			freq_table->unique_count += 1;
+		}
+	}
+	return checkLengths(freq_table->lengths);
+}
+
+/* Reads the count and code lengths written by writeLengths into the
+ * frequency table. Returns 0 on success or -1 if they are cut short or
+ * describe an invalid code. */
+int readLengths(BufReader *in, FrequencyTable *freq_table) {
+	uint32_t count;
+
+	if (readerRead(in, &count, sizeof(uint32_t)) != sizeof(uint32_t)) {
+		return -1;
+	}
+	freq_table->count = ntohl(count);
+	return readCodeLengths(in, freq_table);
+}
+
+/* Reads the varint count and code lengths that follow the version byte
+ * of a VERSION_WIDE file into the frequency table. Returns 0 on success
+ * or -1 if they are cut short or describe an invalid code. */
+int readWideLengths(BufReader *in, FrequencyTable *freq_table) {
+	if (getVarint(in, &freq_table->count) == -1) {
+		return -1;
+	}
+	return readCodeLengths(in, freq_table);
+}
+
+/* Reads the header of a file written by an older hencode: the number of
+ * unique chars. - 1 followed by each char. and its 4 byte frequency. 
+ * Returns 0 on success or -1 if the header is cut short. */
+static int readLegacyHeader(BufReader *in, FrequencyTable *freq_table) {
+	int i;
+	uint8_t ascii;
+	uint32_t freq;
+	int num = readerGetc(in);
+
+	if (num == -1) {
+		return -1;
+	}
+	/* Increment unique_count by 1 */
+	freq_table->unique_count = num + 1;
+	/* Reconstruct the frequency table based on the header. Number of
+	 * times looped is based on the unique_count. */
+	for (i = 0; i < freq_table->unique_count; i++) {
+		if (readerRead(in, &ascii, sizeof(uint8_t)) != sizeof(uint8_t)
+			|| readerRead(in, &freq, sizeof(uint32_t)) 
+				!= sizeof(uint32_t)) {
+			return -1;
+		}
+		freq = ntohl(freq);
+		freq_table->freq[ascii] = freq;
+		freq_table->count += freq;
+	}
+	return 0;
+}
+
+/* Reads the header of an encoded file into a frequency table. Once this
+ * returns, the reader is positioned at the beginning of the body.
+ *
+ * Files that start with the magic bytes and a known version are read as
+ * that version. Anything else is taken to be the original format, which
+ * has no magic bytes. An original file could only be mistaken for a new
+ * one if it had a char. with a frequency over a billion.
+ *
+ * Parameters:
+ *  in - A buffered reader positioned at the start of the file
+ *  freq_table - A pointer to an empty Frequency Table
+ *
+ * Returns the format version of the file, VERSION_LEGACY for the
+ * original format. For a blocked, adaptive or table coded file only the
+ * magic bytes and version are read. Exits if the header is cut short or
+ * invalid.
+ */
+int readHeader(BufReader *in, FrequencyTable *freq_table) {
+	int version = VERSION_LEGACY;
+	int status;
+
+	if (readerPeek(in, MAGIC_LEN + 1) >= MAGIC_LEN + 1 
+		&& memcmp(in->buf + in->pos, HUFF_MAGIC, MAGIC_LEN) == 0
+		&& in->buf[in->pos + MAGIC_LEN] >= VERSION_CANON
+		&& in->buf[in->pos + MAGIC_LEN] <= VERSION_LATEST) {
+		version = in->buf[in->pos + MAGIC_LEN];
+		in->pos += MAGIC_LEN + 1;
+	}
+	if (version == VERSION_LEGACY) {
+		status = readLegacyHeader(in, freq_table);
+	}
+	else if (version == VERSION_CANON) {
+		status = readLengths(in, freq_table);
+	}
+	else if (version == VERSION_WIDE) {
+		status = readWideLengths(in, freq_table);
+	}
+	else {
+		/* The rest of a blocked file is read a block at a time, an
+		 * adaptive file has no header past the version, and a table
+		 * coded file needs its table to be read */
+		status = 0;
+	}
+	if (status == -1) {
+		fprintf(stderr, "invalid or truncated header\n");
+		exit(EXIT_FAILURE);
+	}
+	return version;
+}
+
+/* Encodes a block of memory into a bit writer
+ *
+ * Parameters:
+ *  buf - The bytes to encode
+ *  n - The number of bytes in buf
+ *  bw - The bit writer the codes go to
+ *  codes - The code table, indexed by ASCII value
+ */
+void encodeBytes(const uint8_t *buf, size_t n, BitWriter *bw, 
+		const Code *codes) {
+	size_t i;
+	const Code *code;
+	for (i = 0; i < n; i++) {
+		/* Gets the code belonging to the char */
+		code = &codes[buf[i]];
+		putBits(bw, code->bits, code->len);
+	}
+}
+
+/* Writes a body split into interleaved streams, so that a decoder can
+ * follow several streams at once instead of waiting on each code to
+ * find where the next one starts. Char. i of the input goes to stream
+ * i % nstreams.
+ *
+ * Layout:
+ *  - nstreams, 1 byte
+ *  - The size in bytes of every stream but the last, 4 bytes each in
+ *    network byte order
+ *  - The streams, one after the other, each padded to a whole byte
+ *
+ * Parameters:
+ *  out - A memory writer the body is appended to. The stream sizes are
+ *        filled in once the streams are done, so it must not flush.
+ *  buf - The bytes to encode
+ *  n - The number of bytes in buf
+ *  nstreams - Number of streams, 1 to MAX_STREAMS
+ *  codes - The code table, indexed by ASCII value
+ *  side - nstreams - 1 memory writers that hold streams 1 on while
+ *         stream 0 is written straight to out. They are emptied first.
+ */
+void writeStreams(BufWriter *out, const uint8_t *buf, size_t n, 
+		int nstreams, const Code *codes, BufWriter **side) {
+	BitWriter bw[MAX_STREAMS];
+	const Code *code;
+	size_t i, sizes;
+	uint32_t size;
+	int s;
+
+	writerPutc(out, nstreams);
+	sizes = out->len;
+	size = 0;
+	for (s = 1; s < nstreams; s++) {
+		writerWrite(out, &size, sizeof(uint32_t));
+	}
+	initBitWriter(&bw[0], out);
+	for (s = 1; s < nstreams; s++) {
+		side[s - 1]->len = 0;
+		initBitWriter(&bw[s], side[s - 1]);
+	}
+	for (i = 0; i + nstreams <= n; i += nstreams) {
+		for (s = 0; s < nstreams; s++) {
+			code = &codes[buf[i + s]];
+			putBits(&bw[s], code->bits, code->len);
 		}
 	}
+	for (s = 0; i < n; i++, s++) {
+		code = &codes[buf[i]];
+		putBits(&bw[s], code->bits, code->len);
+	}
+	for (s = 0; s < nstreams; s++) {
+		flushBits(&bw[s]);
+	}
+	/* Stream 0 is in place, fill in the sizes and append the rest */
+	size = htonl(out->len - sizes - (nstreams - 1) * sizeof(uint32_t));
+	for (s = 0; s < nstreams - 1; s++) {
+		memcpy(out->buf + sizes + s * sizeof(uint32_t), &size,
+			sizeof(uint32_t));
+		writerWrite(out, side[s]->buf, side[s]->len);
+		size = htonl(side[s]->len);
+	}
 }
 
 /* Writes a "body" to an output file. The body represents the encoded
  * input file. 
  *
  * Parameters:
- *  fdin - A file descriptor for the input file 
+ *  in - A buffered reader for the input file 
  *  size - The size of the input file 
- *  fdout - A file descriptor for the output file 
+ *  out - A buffered writer for the output file 
  *  freq_table - A pointer to a Frequency Table 
  */
-void makeBody(int fdin, int size, int fdout, FrequencyTable *freq_table) {
-	/* ascii of a read character */
-	unsigned int c = 0;
-	int i, j;
-	/* Holds the number of zeros that need to be padded to a byte */
-	int padding;
-	/* Keeps track of how many characters have been written to out file */
-	int counter = 0;
-	/* The hcode corresponding to a character */
-	char *str_code;
-	/* The length of the hcode */
-	int code_len;
-	/* The literal bit representation of the hcode */
-	uint8_t bit_code = 0;
-	for (i = 0; i < size; i++) {
-		/* Gets a character in the file */
-		read(fdin, &c, 1);
-		/* Gets the code belonging to the char */
-		str_code = freq_table->codes[c];
-		code_len = strlen(str_code);
-		for (j = 0; j < code_len; j++) {
-			/* Multiplying by 2 to keep track of bit position 
-			 * in byte */
-			bit_code = bit_code * 2;
-			if (str_code[j] == '1') {
-				bit_code += 1;	
-			}
-			counter += 1;
-
-			/* A byte has been constructed */ 
-			if (counter % BYTE_SIZE == 0) {
-				/* Convert to network byte order and 
-				 * convert back to 8 bits since htonl 
-				 * returns a 32 bit number */
-				bit_code = (uint8_t)(htonl(bit_code) >> 
-							FOUR_TO_ONE);
-				write(fdout, &bit_code, sizeof(uint8_t));
-				counter = 0;
-			}
+void makeBody(BufReader *in, uint64_t size, BufWriter *out, 
+		FrequencyTable *freq_table) {
+	uint64_t i = 0;
+	size_t chunk;
+	/* Collects the codes into whole words */
+	BitWriter bw;
+
+	if (freq_table->stored) {
+		copyBody(in, size, out);
+		return;
+	}
+	/* A single repeated char. has no body */
+	if (freq_table->unique_count == 1) {
+		return;
+	}
+	initBitWriter(&bw, out);
+	while (i < size) {
+		/* Refill the buffer once every byte in it has been encoded */
+		if (in->pos == in->len && readerFill(in) == 0) {
+			fprintf(stderr, "error reading file: unexpected end\n");
+			exit(EXIT_FAILURE);
+		}
+		chunk = in->len - in->pos;
+		if (chunk > size - i) {
+			chunk = size - i;
+		}
+		encodeBytes(in->buf + in->pos, chunk, &bw, freq_table->codes);
+		in->pos += chunk;
+		i += chunk;
+	}
+	/* Write out the last partial word. Its final byte is padded 
+	 * with zeros. */
+	flushBits(&bw);
+}
+
+/* Copies a stored body of n bytes from a reader to a writer. Exits if
+ * the input ends first. */
+void copyBody(BufReader *in, uint64_t n, BufWriter *out) {
+	size_t chunk;
+	while (n > 0) {
+		if (in->pos == in->len && readerFill(in) == 0) {
+			fprintf(stderr, "error reading file: unexpected end\n");
+			exit(EXIT_FAILURE);
+		}
+		chunk = in->len - in->pos;
+		if (chunk > n) {
+			chunk = n;
+		}
+		writerWrite(out, in->buf + in->pos, chunk);
+		in->pos += chunk;
+		n -= chunk;
+	}
+}
 
+/* Writes n copies of a char. */
+static void writeRun(BufWriter *out, int c, uint64_t n) {
+	size_t chunk;
+	while (n > 0) {
+		if (out->len == out->size) {
+			writerFlush(out);
 		}
+		chunk = out->size - out->len;
+		if (chunk > n) {
+			chunk = n;
+		}
+		memset(out->buf + out->len, c, chunk);
+		out->len += chunk;
+		n -= chunk;
 	}
+}
 
-	/* Check the final counter to see if padding is needed. 
-	 * If it is needed, then we need to pad with zeros via left 
-	 * shifting by however many bits is needed to reach a BYTE_SIZE.
-	 * Then we can write this to the output file */
-	if (counter > 0) {
-		padding = BYTE_SIZE - counter;
-		bit_code = bit_code << padding;
-		/* Convert to network byte order and convert back to 
-		* 8 bits since htonl returns a 32 bit number */
-		bit_code = (uint8_t)(htonl(bit_code) >> FOUR_TO_ONE);
-		write(fdout, &bit_code, sizeof(uint8_t));
+/* Writes out a body that needs no decoding: a stored body is copied and
+ * a single repeated char., whose table resolves every symbol without
+ * using any bits, is written as a run. Returns 1 if the body was one of
+ * those, 0 if it has to be decoded. */
+static int writePlainBody(BufReader *in, BufWriter *out, DecodeTable *table,
+		FrequencyTable *freq_table) {
+	if (freq_table->stored) {
+		copyBody(in, freq_table->count, out);
+		return 1;
+	}
+	if (table->bits == 0 && !table->entries[0].link) {
+		writeRun(out, table->entries[0].value, freq_table->count);
+		return 1;
 	}
+	return 0;
 }
 
-/* Converts a huffman encoded file into its character representation 
+/* Codes resolved by the primary table that fit in the bits left after
+ * a refill */
+#define STREAM_BURST ((64 - BYTE_SIZE) / DT_BITS)
+
+/* Decodes one char. from a stream. Works like the inner loop of decode,
+ * on a bit reader of its own. */
+static inline int streamSymbol(BitReader *br, const DecodeTable *table) {
+	int bits = table->bits;
+	const DecodeEntry *entry = table->entries;
+
+	while (1) {
+		if (br->nbits <= 64 - BYTE_SIZE) {
+			refillBits(br);
+		}
+		if (bits > 0) {
+			entry += br->acc >> (64 - bits);
+		}
+		if (!entry->link) {
+			break;
+		}
+		br->acc <<= bits;
+		br->nbits -= bits;
+		bits = entry->len;
+		entry = table->entries + entry->value;
+	}
+	br->acc <<= entry->len;
+	br->nbits -= entry->len;
+	return entry->value;
+}
+
+/* Decodes a body written by writeStreams. Each round decodes one char.
+ * from every stream; the streams have no dependency on one another, so
+ * the processor works on all of their lookups at the same time. Stored
+ * bodies and runs of a single char. are written as they are.
+ *
+ * Parameters:
+ *  in - A reader holding the whole body in memory, positioned at its
+ *       start
+ *  out - A buffered writer the chars. go to
+ *  table - A decode table built from the code lengths
+ *  freq_table - A pointer to a Frequency Table whose count is the
+ *               number of chars. to decode
+ *
+ * Returns 0 on success or -1 if the stream count or sizes are invalid.
+ */
+int decodeStreams(BufReader *in, BufWriter *out, DecodeTable *table,
+		FrequencyTable *freq_table) {
+	BitReader br[MAX_STREAMS];
+	uint32_t sizes[MAX_STREAMS];
+	const DecodeEntry *entry;
+	int shift;
+	const uint8_t *stream;
+	uint64_t left = freq_table->count;
+	size_t rest, rounds, r;
+	uint8_t *dst;
+	int nstreams, s;
+
+	/* Stored and single char. bodies are never split into streams */
+	if (writePlainBody(in, out, table, freq_table)) {
+		return 0;
+	}
+	nstreams = readerGetc(in);
+	if (nstreams < 1 || nstreams > MAX_STREAMS) {
+		return -1;
+	}
+	for (s = 0; s < nstreams - 1; s++) {
+		if (readerRead(in, &sizes[s], sizeof(uint32_t)) 
+				!= sizeof(uint32_t)) {
+			return -1;
+		}
+		sizes[s] = ntohl(sizes[s]);
+	}
+	stream = in->buf + in->pos;
+	rest = in->len - in->pos;
+	for (s = 0; s < nstreams - 1; s++) {
+		if (sizes[s] > rest) {
+			return -1;
+		}
+		initBitReader(&br[s], stream, sizes[s]);
+		stream += sizes[s];
+		rest -= sizes[s];
+	}
+	initBitReader(&br[nstreams - 1], stream, rest);
+	in->pos = in->len;
+
+	/* A refill leaves room for STREAM_BURST codes that end in the
+	 * primary table, so whole bursts of rounds are decoded with only
+	 * lookups and shifts. A code that goes on into a sub-table is
+	 * finished by streamSymbol, and its stream is refilled after it.
+	 * A file writer is flushed whenever it has no room for a burst, so
+	 * only the last few rounds are left to the loop below. */
+	if (table->bits > 0) {
+		shift = 64 - table->bits;
+		while (left >= STREAM_BURST * nstreams) {
+			if (out->size - out->len < STREAM_BURST * nstreams) {
+				/* A memory writer only grows once it is full,
+				 * which the loop below takes care of */
+				if (out->fd == -1) {
+					break;
+				}
+				writerFlush(out);
+				if (out->size - out->len <
+						STREAM_BURST * nstreams) {
+					break;
+				}
+			}
+			dst = out->buf + out->len;
+			for (s = 0; s < nstreams; s++) {
+				if (br[s].nbits <= 64 - BYTE_SIZE) {
+					refillBits(&br[s]);
+				}
+			}
+			for (r = 0; r < STREAM_BURST; r++) {
+				for (s = 0; s < nstreams; s++) {
+					entry = &table->entries[br[s].acc >> 
+							shift];
+					if (entry->link) {
+						dst[s] = streamSymbol(&br[s], 
+								table);
+						if (br[s].nbits <= 
+							64 - BYTE_SIZE) {
+							refillBits(&br[s]);
+						}
+						continue;
+					}
+					br[s].acc <<= entry->len;
+					br[s].nbits -= entry->len;
+					dst[s] = entry->value;
+				}
+				dst += nstreams;
+			}
+			out->len += STREAM_BURST * nstreams;
+			left -= STREAM_BURST * nstreams;
+		}
+	}
+	while (left >= nstreams) {
+		rounds = (out->size - out->len) / nstreams;
+		/* No room for a whole round, go through the writer */
+		if (rounds == 0) {
+			for (s = 0; s < nstreams; s++) {
+				writerPutc(out, streamSymbol(&br[s], table));
+			}
+			left -= nstreams;
+			continue;
+		}
+		if (rounds > left / nstreams) {
+			rounds = left / nstreams;
+		}
+		dst = out->buf + out->len;
+		for (r = 0; r < rounds; r++) {
+			for (s = 0; s < nstreams; s++) {
+				dst[s] = streamSymbol(&br[s], table);
+			}
+			dst += nstreams;
+		}
+		out->len += rounds * nstreams;
+		left -= rounds * nstreams;
+	}
+	for (s = 0; left > 0; s++, left--) {
+		writerPutc(out, streamSymbol(&br[s], table));
+	}
+	return 0;
+}
+
+/* Bytes kept past the bit reader's position while decoding from the
+ * reader's buffer. A burst of codes never reads further than this, so
+ * every refill is a whole 8 byte load of body bytes. */
+#define DECODE_SLACK 64
+
+/* Converts a huffman encoded file into its character representation.
+ * The body is read through a bit reader over the reader's buffer, and
+ * each symbol is found by looking the top bits up in the decode table,
+ * following a sub-table link when the code is longer than the primary
+ * table. Chars. go straight into the writer's buffer. The last few
+ * bytes of the body are decoded from a zero padded copy, and a code
+ * that runs past them means the body was cut short. Stored bodies and
+ * runs of a single char. skip all of this.
  * 
  * Parameters:
- *  fdin - A file descriptor for the input file
- *  fdout - A file descriptor for the output file
- *  tree - A pointer to a node that represents a huffman tree
+ *  in - A buffered reader positioned at the start of the body
+ *  out - A buffered writer for the output file
+ *  table - A decode table built from the huffman tree
  *  freq_table - A pointer to a Frequency Table
+ *
+ * Returns 0 on success or -1 if the body ends before all of the chars.
+ * are decoded.
  */
-void decode(int fdin, int fdout, Node *tree, FrequencyTable *freq_table) {
-	/* Saves the top of the tree */
-	Node *root = tree;
-	int i;
-	/* Keeps track of how many characters have been decoded */
-	int counter = 0;
-	/* Stores a bit based on the byte that was read from the body */
-	int first_bit;
-	/* Sets a constant that will be used as an operand when getting the 
-	 * first bit from a byt*/
-	const int bit = 1;
-	uint8_t read_byte;
-
-	/* Keep reading bytes. The loop will stop once all the 
-	 * characters have been decoded. 
-	 * Empty file check occurs in main. 
-	 * Single character check occurs in main. */
-	while (1) {
-		/* Reads a byte from the body */
-		read(fdin, &read_byte, sizeof(uint8_t));
-
-		/* Traversing tree */
-		for (i = 0; i < BYTE_SIZE; i++) {
-			/* Left shift the read byte by 1 with rotation so 
-			 * that the most significant bit becomes the least 
-			 * significant bit */
-			read_byte = (read_byte << 1) | 
-						(read_byte >> (BYTE_SIZE - 1));
-
-			/* Gets the first bit in the read byte */
-			first_bit = read_byte & bit;
-			/* Traverse left */
-			if ((first_bit == 0) && (tree->left)) {
-				tree = tree->left;
+int decode(BufReader *in, BufWriter *out, DecodeTable *table, 
+		FrequencyTable *freq_table) {
+	/* Chars. still to be decoded */
+	uint64_t left = freq_table->count;
+	BitReader br;
+	/* The end of the body, padded with zeros */
+	uint8_t tail[4 * DECODE_SLACK];
+	const uint8_t *base;
+	/* Bits of the first unread byte already used by the last code */
+	int skip = 0;
+	uint64_t used;
+	size_t n, room, k, r;
+	const DecodeEntry *entry;
+	int shift = 64 - table->bits;
+	uint8_t *dst;
+	int c;
+
+	if (writePlainBody(in, out, table, freq_table)) {
+		return 0;
+	}
+	while (left > 0) {
+		if (in->len - in->pos < 2 * DECODE_SLACK) {
+			readerPeek(in, 2 * DECODE_SLACK);
+		}
+		n = in->len - in->pos;
+		if (n < 2 * DECODE_SLACK) {
+			break;
+		}
+		base = in->buf + in->pos;
+		initBitReader(&br, base, n);
+		br.acc <<= skip;
+		br.nbits -= skip;
+		while (left > 0 && br.end - br.pos >= DECODE_SLACK) {
+			if (out->len == out->size) {
+				writerFlush(out);
 			}
-			/* Traverse right */
-			if ((first_bit == 1) && (tree->right)) {
-				tree = tree->right;
+			room = out->size - out->len;
+			if (room > left) {
+				room = left;
 			}
-			
-			/* Leaf node reached */
-			if (!(tree->left && tree->right)) {
-				/* Write char to out_file. A char is one byte, 
-				 * so write one byte to the file */
-				write(fdout, &tree->ascii, sizeof(uint8_t));
-				counter += 1;
-				/* Go back to the top of the tree */
-				tree = root;
+			dst = out->buf + out->len;
+			k = 0;
+			/* A refill leaves room for STREAM_BURST codes that
+			 * end in the primary table, as in decodeStreams */
+			while (k + STREAM_BURST <= room
+					&& br.end - br.pos >= DECODE_SLACK) {
+				if (br.nbits <= 64 - BYTE_SIZE) {
+					refillBits(&br);
+				}
+				for (r = 0; r < STREAM_BURST; r++) {
+					entry = &table->entries[br.acc >> shift];
+					if (entry->link) {
+						dst[k++] = streamSymbol(&br,
+								table);
+						if (br.nbits <= 64 - BYTE_SIZE) {
+							refillBits(&br);
+						}
+						continue;
+					}
+					br.acc <<= entry->len;
+					br.nbits -= entry->len;
+					dst[k++] = entry->value;
+				}
 			}
-
-			/* Check if all characters have been decoded */
-			if (counter == freq_table->count) {
-				return;
+			while (k < room && br.end - br.pos >= DECODE_SLACK) {
+				dst[k++] = streamSymbol(&br, table);
 			}
+			out->len += k;
+			left -= k;
 		}
+		/* Every refill was a whole load, so the bits used are exact */
+		used = (uint64_t)(br.pos - base) * BYTE_SIZE - br.nbits;
+		in->pos += used / BYTE_SIZE;
+		skip = used % BYTE_SIZE;
+	}
+	if (left == 0) {
+		return 0;
 	}
+	/* The input is used up, and only the last few bytes are left */
+	n = in->len - in->pos;
+	memset(tail, 0, sizeof(tail));
+	memcpy(tail, in->buf + in->pos, n);
+	initBitReader(&br, tail, sizeof(tail));
+	br.acc <<= skip;
+	br.nbits -= skip;
+	while (left > 0) {
+		c = streamSymbol(&br, table);
+		used = (uint64_t)(br.pos - tail) * BYTE_SIZE - br.nbits;
+		if (used > (uint64_t)n * BYTE_SIZE) {
+			return -1;
+		}
+		writerPutc(out, c);
+		left -= 1;
+	}
+	in->pos += (used + BYTE_SIZE - 1) / BYTE_SIZE;
+	return 0;
 }
-
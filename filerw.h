@@ -5,9 +5,55 @@
 #define FINFOH
 #include "freq.h"
 #include "llist.h"
+#include "bufio.h"
+#include "dtable.h"
 
-void makeHeader(int, FrequencyTable *);
-void makeBody(int, int, int, FrequencyTable *);
-void decode(int, int, Node *, FrequencyTable *);
+/* Magic bytes at the start of every file in a versioned format */
+#define HUFF_MAGIC "HUF"
+#define MAGIC_LEN 3
+/* The original format: char. frequencies and no magic bytes */
+#define VERSION_LEGACY 0
+/* Canonical codes with only code lengths in the header */
+#define VERSION_CANON 1
+/* Independent blocks, each with its own code lengths, and an index */
+#define VERSION_BLOCKED 2
+/* Adaptive codes updated after every symbol, with no header at all */
+#define VERSION_ADAPTIVE 3
+/* Canonical codes with a 64 bit varint count, for inputs over 4G */
+#define VERSION_WIDE 4
+/* Canonical codes from a table trained by htrain, named only by its id */
+#define VERSION_DICT 5
+/* Blocked, with each block's body split into interleaved streams */
+#define VERSION_INTERLEAVED 6
+/* Newest version this build understands */
+#define VERSION_LATEST VERSION_INTERLEAVED
+/* Largest code length that can be packed into half a byte */
+#define NIBBLE_MAX 15
+/* Most bytes a 64 bit varint takes */
+#define VARINT_MAX 10
+/* First byte of the code lengths when the body is a single repeated
+ * char. and holds no bits. Any other value up to MAX_CODE_LEN is the
+ * longest code of a huffman coded body. */
+#define MODE_RUN 0
+/* First byte of the code lengths when the body is stored as it is */
+#define MODE_STORED 0xff
+/* Most interleaved streams a body can be split into */
+#define MAX_STREAMS 8
+
+void putVarint(BufWriter *, uint64_t);
+void chooseMode(FrequencyTable *);
+int getVarint(BufReader *, uint64_t *);
+void writeLengths(BufWriter *, FrequencyTable *);
+void makeHeader(BufWriter *, FrequencyTable *);
+int readLengths(BufReader *, FrequencyTable *);
+int readWideLengths(BufReader *, FrequencyTable *);
+int readHeader(BufReader *, FrequencyTable *);
+void encodeBytes(const uint8_t *, size_t, BitWriter *, const Code *);
+void makeBody(BufReader *, uint64_t, BufWriter *, FrequencyTable *);
+void writeStreams(BufWriter *, const uint8_t *, size_t, int, const Code *,
+		BufWriter **);
+void copyBody(BufReader *, uint64_t, BufWriter *);
+int decode(BufReader *, BufWriter *, DecodeTable *, FrequencyTable *);
+int decodeStreams(BufReader *, BufWriter *, DecodeTable *, FrequencyTable *);
 #endif
 
@@ -4,66 +4,192 @@
 #include <ctype.h>
 #include "freq.h"
 #include "filerw.h"
+#include "pool.h"
 
-/* Initializes a frequency table */
+/* Initializes a frequency table. Returns NULL if it can't be
+ * allocated. */
 FrequencyTable *makeFreqTable(void) {
 	int i;
 	FrequencyTable *freq_table = calloc(1, sizeof(FrequencyTable));
 	if (!freq_table) {
-		perror("malloc FrequencyTable");
-		exit(EXIT_FAILURE);
+		return NULL;
 	}
 	freq_table->count = 0;
 	freq_table->unique_count = 0;
 	freq_table->size = MAX_NUM_BYTES;
-	freq_table->codes = calloc(MAX_NUM_BYTES, sizeof(char *));
-	if (!freq_table->codes) {
-		perror("calloc");
-		exit(EXIT_FAILURE);
-	}
 	for (i = 0; i < freq_table->size; i++) {
 		freq_table->freq[i] = 0;
-		freq_table->codes[i] = NULL;
+		freq_table->codes[i].bits = 0;
+		freq_table->codes[i].len = 0;
+		freq_table->lengths[i] = 0;
 	}
 	
 	return freq_table;
 }
 
-/* Puts the frequencies of all characters in a file into a freq table */
-void genFreq(int fdin, int size, FrequencyTable *freq_table) {
-	int i;
-	unsigned int c = 0;
-	int status;
+/* Adds the byte counts of up to HIST_SLAB bytes of memory to counts.
+ * Bytes are loaded a word at a time and spread over HIST_WAYS separate
+ * tables, so a run of the same byte does not make each increment wait
+ * on the one before it. The tables are summed into counts at the end. */
+static void histogramSlab(const uint8_t *buf, size_t n, uint64_t *counts) {
+	uint32_t sub[HIST_WAYS][MAX_NUM_BYTES];
+	uint64_t a, b;
+	size_t i = 0;
+	int c, j;
+
+	memset(sub, 0, sizeof(sub));
+	for (; i + 16 <= n; i += 16) {
+		memcpy(&a, buf + i, sizeof(a));
+		memcpy(&b, buf + i + 8, sizeof(b));
+		for (j = 0; j < 64; j += 16) {
+			sub[0][(a >> j) & 0xff] += 1;
+			sub[1][(a >> (j + 8)) & 0xff] += 1;
+			sub[2][(b >> j) & 0xff] += 1;
+			sub[3][(b >> (j + 8)) & 0xff] += 1;
+		}
+	}
+	for (; i < n; i++) {
+		sub[0][buf[i]] += 1;
+	}
+	for (c = 0; c < MAX_NUM_BYTES; c++) {
+		counts[c] += (uint64_t)sub[0][c] + sub[1][c] + sub[2][c] + 
+				sub[3][c];
+	}
+}
+
+/* Adds the byte counts of a block of memory of any size to counts, a
+ * slab at a time so that the 32 bit sub-histograms can't overflow */
+static void histogram(const uint8_t *buf, size_t n, uint64_t *counts) {
+	size_t chunk;
+	while (n > 0) {
+		chunk = n > HIST_SLAB ? HIST_SLAB : n;
+		histogramSlab(buf, chunk, counts);
+		buf += chunk;
+		n -= chunk;
+	}
+}
+
+/* Sets unique_count from the counts in a freq table */
+static void countUnique(FrequencyTable *freq_table) {
+	int c;
+	freq_table->unique_count = 0;
+	for (c = 0; c < MAX_NUM_BYTES; c++) {
+		freq_table->unique_count += freq_table->freq[c] != 0;
+	}
+}
+
+/* Adds the characters in a block of memory to a freq table */
+void countFreq(const uint8_t *buf, size_t n, FrequencyTable *freq_table) {
+	histogram(buf, n, freq_table->freq);
+	freq_table->count += n;
+	countUnique(freq_table);
+}
+
+/* HistSlice: The part of a buffer counted by one task, along with its
+ * own counts */
+typedef struct HistSlice {
+	Task task;
+	const uint8_t *buf;
+	size_t n;
+	uint64_t counts[MAX_NUM_BYTES];
+} HistSlice;
+
+/* Task function counting one slice */
+static void countSlice(void *arg) {
+	HistSlice *slice = arg;
+	histogram(slice->buf, slice->n, slice->counts);
+}
+
+/* Adds the characters in a block of memory to a freq table, splitting
+ * the block between threads. Each thread counts its slice on its own
+ * and the counts are summed once all are done. Blocks too small to be
+ * worth starting threads for are counted by the caller.
+ *
+ * Parameters:
+ *  buf - The bytes to count
+ *  n - The number of bytes in buf
+ *  freq_table - A pointer to a Frequency Table
+ *  threads - The number of threads to use
+ */
+void countFreqParallel(const uint8_t *buf, size_t n, 
+		FrequencyTable *freq_table, int threads) {
+	ThreadPool *pool;
+	HistSlice *slices;
+	size_t per, start;
+	int i, c;
+
+	if (threads <= 1 || n < PARALLEL_HIST_MIN) {
+		countFreq(buf, n, freq_table);
+		return;
+	}
+	slices = calloc(threads, sizeof(HistSlice));
+	if (!slices) {
+		perror("malloc HistSlice");
+		exit(EXIT_FAILURE);
+	}
+	pool = makePool(threads);
+	per = n / threads;
+	start = 0;
+	for (i = 0; i < threads; i++) {
+		slices[i].buf = buf + start;
+		slices[i].n = i == threads - 1 ? n - start : per;
+		slices[i].task.fn = countSlice;
+		slices[i].task.arg = &slices[i];
+		start += per;
+		poolSubmit(pool, &slices[i].task);
+	}
+	for (i = 0; i < threads; i++) {
+		poolWaitTask(pool, &slices[i].task);
+		for (c = 0; c < MAX_NUM_BYTES; c++) {
+			freq_table->freq[c] += slices[i].counts[c];
+		}
+	}
+	poolDestroy(pool);
+	free(slices);
+	freq_table->count += n;
+	countUnique(freq_table);
+}
+
+/* Puts the frequencies of all characters in a file into a freq table.
+ * Bytes are counted straight out of the reader's buffer. A file that is
+ * already all in memory is counted by threads threads at once.
+ *
+ * Parameters:
+ *  in - A buffered reader for the input file
+ *  size - The size of the input file
+ *  freq_table - A pointer to a Frequency Table
+ *  threads - The number of threads counting a mapped file
+ */
+void genFreq(BufReader *in, uint64_t size, FrequencyTable *freq_table, 
+		int threads) {
+	uint64_t i;
+	size_t chunk;
+
+	if (in->fixed && in->len - in->pos >= size) {
+		countFreqParallel(in->buf + in->pos, size, freq_table, threads);
+		in->pos += size;
+		return;
+	}
 	/* read each character from file and put into frequency table */
-	for (i = 0; i < size; i++) {
-		/* Read a char into c */
-		status = read(fdin, &c, sizeof(char));
-		
-		/* Check for error reading file */
-		if (status == -1) {
-			perror("error reading file");
-			close(fdin);
+	i = 0;
+	while (i < size) {
+		/* Refill the buffer once every byte in it has been counted */
+		if (in->pos == in->len && readerFill(in) == 0) {
+			fprintf(stderr, "error reading file: unexpected end\n");
 			exit(EXIT_FAILURE);
 		}
-		if (freq_table->freq[c] == 0) {
-			freq_table->unique_count += 1;
+		chunk = in->len - in->pos;
+		if (chunk > size - i) {
+			chunk = size - i;
 		}
-		freq_table->freq[c] += 1;
-		freq_table->count += 1;
+		countFreq(in->buf + in->pos, chunk, freq_table);
+		in->pos += chunk;
+		i += chunk;
 	}
 }
 
 /* Free the frequency table */
 void ftableDestroy(FrequencyTable *freq_table) {
-	int i;
-	for (i = 0; i < MAX_NUM_BYTES; i++) {
-		if (freq_table->codes[i]) {
-			/* Frees the codes */
-			free(freq_table->codes[i]);
-		}
-	}
-	/* Frees the code table */
-	free(freq_table->codes);
 	/* Frees the table */
 	free(freq_table);
 }
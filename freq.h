@@ -5,14 +5,30 @@
 
 #ifndef FREQH
 #define FREQH
+#include "bufio.h"
 
 #define MAX_NUM_BYTES 256
+/* Number of separate tables bytes are counted into */
+#define HIST_WAYS 4
+/* Smallest buffer whose counting is split between threads */
+#define PARALLEL_HIST_MIN (1 << 22)
+/* Most bytes counted into the 32 bit sub-histograms before they are
+ * added to the 64 bit counts */
+#define HIST_SLAB (1 << 30)
+
+/* Code: A character's huffman code held as an integer */
+typedef struct Code {
+	/* The bits of the code, right aligned */
+	uint64_t bits;
+	/* Number of bits in the code */
+	unsigned int len;
+} Code;
 
 /* Frequency Table contains a size which will be 256 to represents bits 0-255.
  * C */
 typedef struct FrequencyTable {
 	/* Total number of chars. in the file */
-	unsigned int count;
+	uint64_t count;
 	/* Number of unique chars. in the file. */
 	unsigned int unique_count;
 	/* Total size of the frequency table which is 256 */
@@ -20,13 +36,20 @@ typedef struct FrequencyTable {
 	/* An unsigned integer array of size 256. The index of the array is the 
 	 * ASCII value of a character and the data at that index is the 
 	 * frequency. */
-	unsigned int freq[MAX_NUM_BYTES];
-	/* Array of character pointers to hold each character's encoded code */
-	char **codes;
-	
+	uint64_t freq[MAX_NUM_BYTES];
+	/* Each character's code, indexed by ASCII value */
+	Code codes[MAX_NUM_BYTES];
+	/* Length in bits of each character's code, 0 if it does not appear */
+	uint8_t lengths[MAX_NUM_BYTES];
+	/* Set when the body holds the chars. as they are, since coding them
+	 * would not make it any smaller */
+	int stored;
+
 } FrequencyTable;
 
 FrequencyTable *makeFreqTable(void);
-void genFreq(int, int, FrequencyTable *);
+void countFreq(const uint8_t *, size_t, FrequencyTable *);
+void countFreqParallel(const uint8_t *, size_t, FrequencyTable *, int);
+void genFreq(BufReader *, uint64_t, FrequencyTable *, int);
 void ftableDestroy(FrequencyTable *);
 #endif
@@ -0,0 +1,452 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "freq.h"
+#include "bufio.h"
+#include "canon.h"
+#include "dtable.h"
+#include "filerw.h"
+
+/* Input bytes per corpus when -s is not given */
+#define DEFAULT_CORPUS_SIZE (16 << 20)
+/* Size of the tiny corpus, about one small message */
+#define TINY_SIZE 64
+/* Each phase is repeated until it has run for at least this long */
+#define MIN_SECONDS 0.25
+/* Slowdown, in percent, that counts as a regression when comparing */
+#define DEFAULT_THRESHOLD 10.0
+/* Most corpora one run can measure */
+#define MAX_CORPORA 64
+/* Longest corpus name */
+#define NAME_LEN 64
+
+/* Corpus: The bytes one set of measurements is taken over */
+typedef struct Corpus {
+	char name[NAME_LEN];
+	uint8_t *data;
+	size_t n;
+	/* Reader the data belongs to when it was loaded from a file */
+	BufReader *file;
+} Corpus;
+
+/* Result: What was measured over one corpus. Speeds are in MB/s of
+ * input; the tree build is timed per build since it does not depend on
+ * the input size. */
+typedef struct Result {
+	char name[NAME_LEN];
+	size_t n;
+	/* Compressed size, header included, over input size */
+	double ratio;
+	double hist_mbps;
+	double build_us;
+	double encode_mbps;
+	double decode_mbps;
+} Result;
+
+/* Returns the time in seconds from a monotonic clock */
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Next value of a xorshift generator, so corpora are the same on every
+ * run */
+static uint64_t nextRandom(uint64_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+/* Allocates the bytes of a generated corpus */
+static uint8_t *corpusAlloc(size_t n) {
+	uint8_t *data = malloc(n ? n : 1);
+	if (!data) {
+		perror("malloc corpus");
+		exit(EXIT_FAILURE);
+	}
+	return data;
+}
+
+/* Fills a buffer with log lines made of a few fixed words, numbers and
+ * hex ids, about the mix of a service's text logs */
+static void genText(uint8_t *data, size_t n, uint64_t *state) {
+	static const char *levels[] = { "INFO", "INFO", "INFO", "DEBUG",
+					"WARN", "ERROR" };
+	static const char *words[] = { "request", "served", "user",
+		"session", "cache", "miss", "hit", "upstream", "timeout",
+		"GET", "POST", "/api/v1/items", "/health", "status=200",
+		"status=404", "status=500", "latency_ms=" };
+	char line[256];
+	size_t i = 0, len;
+	int k, nwords;
+
+	while (i < n) {
+		len = snprintf(line, sizeof(line),
+			"2024-05-%02d %02d:%02d:%02d %s [%08llx]",
+			(int)(nextRandom(state) % 28) + 1,
+			(int)(nextRandom(state) % 24),
+			(int)(nextRandom(state) % 60),
+			(int)(nextRandom(state) % 60),
+			levels[nextRandom(state) % 6],
+			(unsigned long long)(nextRandom(state) & 0xffffffff));
+		nwords = 3 + nextRandom(state) % 6;
+		for (k = 0; k < nwords && len < sizeof(line) - 32; k++) {
+			len += snprintf(line + len, sizeof(line) - len, " %s",
+				words[nextRandom(state) % 17]);
+		}
+		len += snprintf(line + len, sizeof(line) - len, " %u\n",
+				(unsigned)(nextRandom(state) % 10000));
+		if (len > n - i) {
+			len = n - i;
+		}
+		memcpy(data + i, line, len);
+		i += len;
+	}
+}
+
+/* Generates the built in corpora. Each one but tiny holds size bytes. */
+static int genCorpora(Corpus *corpora, size_t size) {
+	uint64_t state = 0x9e3779b97f4a7c15ULL;
+	uint64_t r;
+	size_t i;
+	int c, k = 0;
+
+	/* Text logs */
+	strcpy(corpora[k].name, "text");
+	corpora[k].data = corpusAlloc(size);
+	corpora[k].n = size;
+	genText(corpora[k].data, size, &state);
+	k++;
+
+	/* Skewed: each byte value half as likely as the one before */
+	strcpy(corpora[k].name, "skewed");
+	corpora[k].data = corpusAlloc(size);
+	corpora[k].n = size;
+	for (i = 0; i < size; i++) {
+		r = nextRandom(&state);
+		c = r ? __builtin_ctzll(r) : 63;
+		corpora[k].data[i] = 'a' + c;
+	}
+	k++;
+
+	/* Uniform: every byte value exactly as common as the others */
+	strcpy(corpora[k].name, "uniform");
+	corpora[k].data = corpusAlloc(size);
+	corpora[k].n = size;
+	for (i = 0; i < size; i++) {
+		corpora[k].data[i] = (i * 167) & 0xff;
+	}
+	k++;
+
+	/* Random bytes */
+	strcpy(corpora[k].name, "random");
+	corpora[k].data = corpusAlloc(size);
+	corpora[k].n = size;
+	for (i = 0; i < size; i++) {
+		corpora[k].data[i] = nextRandom(&state) >> 56;
+	}
+	k++;
+
+	/* A single repeated byte */
+	strcpy(corpora[k].name, "single");
+	corpora[k].data = corpusAlloc(size);
+	corpora[k].n = size;
+	memset(corpora[k].data, 'x', size);
+	k++;
+
+	/* A tiny message, where per call costs dominate */
+	strcpy(corpora[k].name, "tiny");
+	corpora[k].data = corpusAlloc(TINY_SIZE);
+	corpora[k].n = TINY_SIZE;
+	genText(corpora[k].data, TINY_SIZE, &state);
+	k++;
+	return k;
+}
+
+/* Loads a file as a corpus named after it */
+static void loadCorpus(Corpus *corpus, const char *path) {
+	struct stat file_info;
+	int fd = open(path, O_RDONLY);
+
+	if (fd == -1 || fstat(fd, &file_info)) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	corpus->n = file_info.st_size;
+	corpus->file = mapReader(fd, corpus->n);
+	if (!corpus->file) {
+		corpus->file = makeReader(fd, corpus->n ? corpus->n : 1);
+		if (corpus->n && readerPeek(corpus->file, corpus->n)
+				< corpus->n) {
+			fprintf(stderr, "%s: unexpected end\n", path);
+			exit(EXIT_FAILURE);
+		}
+	}
+	close(fd);
+	corpus->data = corpus->file->buf;
+	snprintf(corpus->name, NAME_LEN, "file:%s", path);
+}
+
+/* Measures every phase over a corpus. Each phase is run over and over
+ * until MIN_SECONDS have gone by and the average is kept. */
+static void benchCorpus(Corpus *corpus, Result *result) {
+	FrequencyTable *freq_table = makeFreqTable();
+	DecodeTable *table;
+	BufWriter *body = makeMemWriter(corpus->n + 64);
+	BufWriter *header = makeMemWriter(BUF_SIZE);
+	BufWriter *out = makeMemWriter(corpus->n + 64);
+	BufReader *in;
+	BitWriter bw;
+	double start, elapsed;
+	long iters;
+	double mb = corpus->n / 1e6;
+
+	if (!freq_table) {
+		perror("malloc FrequencyTable");
+		exit(EXIT_FAILURE);
+	}
+	strcpy(result->name, corpus->name);
+	result->n = corpus->n;
+
+	/* Histogram */
+	iters = 0;
+	start = now();
+	do {
+		memset(freq_table->freq, 0, sizeof(freq_table->freq));
+		freq_table->count = 0;
+		countFreq(corpus->data, corpus->n, freq_table);
+		iters++;
+	} while ((elapsed = now() - start) < MIN_SECONDS);
+	result->hist_mbps = mb * iters / elapsed;
+
+	/* Tree build and canonical codes */
+	iters = 0;
+	start = now();
+	do {
+		makeCodes(freq_table, 0);
+		iters++;
+	} while ((elapsed = now() - start) < MIN_SECONDS);
+	result->build_us = elapsed / iters * 1e6;
+
+	/* Encode */
+	iters = 0;
+	start = now();
+	do {
+		body->len = 0;
+		initBitWriter(&bw, body);
+		encodeBytes(corpus->data, corpus->n, &bw, freq_table->codes);
+		flushBits(&bw);
+		iters++;
+	} while ((elapsed = now() - start) < MIN_SECONDS);
+	result->encode_mbps = mb * iters / elapsed;
+
+	writeLengths(header, freq_table);
+	result->ratio = corpus->n ? (double)(MAGIC_LEN + 1 + header->len
+				+ body->len) / corpus->n : 0;
+
+	/* Decode, including building the decode table */
+	iters = 0;
+	start = now();
+	do {
+		in = memReader(body->buf, body->len);
+		out->len = 0;
+		table = makeLengthsTable(freq_table);
+		if (!table) {
+			perror("malloc DecodeTable");
+			exit(EXIT_FAILURE);
+		}
+		if (decode(in, out, table, freq_table) == -1) {
+			fprintf(stderr, "unexpected end of body\n");
+			exit(EXIT_FAILURE);
+		}
+		dtableDestroy(table);
+		readerDestroy(in);
+		iters++;
+	} while ((elapsed = now() - start) < MIN_SECONDS);
+	result->decode_mbps = mb * iters / elapsed;
+
+	if (out->len != corpus->n
+		|| memcmp(out->buf, corpus->data, corpus->n) != 0) {
+		fprintf(stderr, "%s: decoded output differs from input\n",
+			corpus->name);
+		exit(EXIT_FAILURE);
+	}
+	ftableDestroy(freq_table);
+	writerDestroy(body);
+	writerDestroy(header);
+	writerDestroy(out);
+}
+
+/* Prints one result as a tab separated line */
+static void printResult(FILE *f, Result *result) {
+	fprintf(f, "%s\t%zu\t%.4f\t%.1f\t%.2f\t%.1f\t%.1f\n", result->name,
+		result->n, result->ratio, result->hist_mbps, result->build_us,
+		result->encode_mbps, result->decode_mbps);
+}
+
+/* Reads results printed by an earlier run. Lines starting with # are
+ * skipped. Returns the number of results read. */
+static int readResults(const char *path, Result *results) {
+	FILE *f = fopen(path, "r");
+	char line[512];
+	int k = 0;
+
+	if (!f) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	while (k < MAX_CORPORA && fgets(line, sizeof(line), f)) {
+		if (line[0] == '#') {
+			continue;
+		}
+		if (sscanf(line, "%63[^\t]\t%zu\t%lf\t%lf\t%lf\t%lf\t%lf",
+			results[k].name, &results[k].n, &results[k].ratio,
+			&results[k].hist_mbps, &results[k].build_us,
+			&results[k].encode_mbps,
+			&results[k].decode_mbps) == 7) {
+			k++;
+		}
+	}
+	fclose(f);
+	return k;
+}
+
+/* Returns the change from base to cur in percent, positive when cur is
+ * better. lower_better is set for times. */
+static double change(double base, double cur, int lower_better) {
+	if (base == 0 || cur == 0) {
+		return 0;
+	}
+	return lower_better ? (base / cur - 1) * 100 : (cur / base - 1) * 100;
+}
+
+/* Compares results with a baseline, printing the change of every
+ * measurement. Returns the number of measurements that got slower by
+ * more than threshold percent, or whose ratio got worse. */
+static int compareResults(Result *results, int n, Result *base, int nbase,
+		double threshold) {
+	int i, j, k, regressions = 0;
+	double d[4];
+	static const char *names[] = { "hist", "build", "encode", "decode" };
+
+	printf("# corpus\tmeasure\tchange%%\n");
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < nbase; j++) {
+			if (strcmp(results[i].name, base[j].name) == 0 &&
+				results[i].n == base[j].n) {
+				break;
+			}
+		}
+		if (j == nbase) {
+			continue;
+		}
+		d[0] = change(base[j].hist_mbps, results[i].hist_mbps, 0);
+		d[1] = change(base[j].build_us, results[i].build_us, 1);
+		d[2] = change(base[j].encode_mbps, results[i].encode_mbps, 0);
+		d[3] = change(base[j].decode_mbps, results[i].decode_mbps, 0);
+		for (k = 0; k < 4; k++) {
+			printf("%s\t%s\t%+.1f%s\n", results[i].name, names[k],
+				d[k], d[k] < -threshold ? "\tREGRESSION" : "");
+			regressions += d[k] < -threshold;
+		}
+		/* Ratios are printed to 4 places, so smaller changes are
+		 * only rounding */
+		if (results[i].ratio > base[j].ratio + 0.00005) {
+			printf("%s\tratio\t%.4f -> %.4f\tREGRESSION\n",
+				results[i].name, base[j].ratio,
+				results[i].ratio);
+			regressions++;
+		}
+	}
+	return regressions;
+}
+
+int main(int argc, char *argv[]) {
+	Corpus corpora[MAX_CORPORA];
+	Result results[MAX_CORPORA], base[MAX_CORPORA];
+	int ncorpora = 0, nbase, i;
+	int opt;
+	int bad_option = 0;
+	/* Set by -n to measure only the files given with -f */
+	int no_builtin = 0;
+	/* Bytes per generated corpus */
+	size_t size = DEFAULT_CORPUS_SIZE;
+	/* Earlier results to compare against, from -c */
+	const char *baseline = NULL;
+	double threshold = DEFAULT_THRESHOLD;
+	int regressions = 0;
+
+	memset(corpora, 0, sizeof(corpora));
+	while ((opt = getopt(argc, argv, "s:f:c:t:n")) != -1) {
+		switch (opt) {
+			case 's':
+				size = parseSize(optarg);
+				if (size == 0) {
+					fprintf(stderr, "%s: bad size %s\n",
+						argv[0], optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'f':
+				if (ncorpora == MAX_CORPORA) {
+					fprintf(stderr, "%s: too many files\n",
+						argv[0]);
+					exit(EXIT_FAILURE);
+				}
+				loadCorpus(&corpora[ncorpora++], optarg);
+				break;
+			case 'c':
+				baseline = optarg;
+				break;
+			case 't':
+				threshold = atof(optarg);
+				break;
+			case 'n':
+				no_builtin = 1;
+				break;
+			default:
+				bad_option = 1;
+		}
+	}
+	if (bad_option || optind != argc
+		|| (!no_builtin && ncorpora > MAX_CORPORA - 6)) {
+		fprintf(stderr, "usage: %s [ -s size ] [ -f file ]... [ -n ] "
+			"[ -c baseline ] [ -t percent ]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	if (!no_builtin) {
+		ncorpora += genCorpora(corpora + ncorpora, size);
+	}
+
+	printf("# corpus\tbytes\tratio\thist_MBps\tbuild_us\t"
+		"encode_MBps\tdecode_MBps\n");
+	for (i = 0; i < ncorpora; i++) {
+		benchCorpus(&corpora[i], &results[i]);
+		printResult(stdout, &results[i]);
+		fflush(stdout);
+	}
+
+	if (baseline) {
+		nbase = readResults(baseline, base);
+		regressions = compareResults(results, ncorpora, base, nbase,
+						threshold);
+	}
+
+	for (i = 0; i < ncorpora; i++) {
+		if (corpora[i].file) {
+			readerDestroy(corpora[i].file);
+		}
+		else {
+			free(corpora[i].data);
+		}
+	}
+	return regressions ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -2,7 +2,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <fcntl.h>
 #include <arpa/inet.h>
 #include <sys/types.h>
@@ -11,21 +13,115 @@
 #include "filerw.h"
 #include "freq.h"
 #include "llist.h"
+#include "bufio.h"
+#include "dtable.h"
+#include "block.h"
+#include "pool.h"
+#include "adaptive.h"
+#include "stats.h"
+#include "dict.h"
+#include "sync.h"
+
+/* Long options, which have no single letter form */
+static struct option long_options[] = {
+	{ "stats", no_argument, NULL, 'S' },
+	{ "range", required_argument, NULL, 'R' },
+	{ NULL, 0, NULL, 0 }
+};
+
+/* Parses one plain decimal number of a range, leaving end just past it.
+ * Returns 0 on success or -1 if it isn't a number or doesn't fit in 64
+ * bits. */
+static int parseNumber(const char *arg, char **end, uint64_t *value) {
+	/* strtoull would take a sign or leading space as well */
+	if (!isdigit((unsigned char)*arg)) {
+		return -1;
+	}
+	errno = 0;
+	*value = strtoull(arg, end, 10);
+	return errno == ERANGE ? -1 : 0;
+}
+
+/* Parses a range given as offset:length, both in bytes. Returns 0 on
+ * success or -1 if it isn't a range or runs past the largest offset. */
+static int parseRange(const char *arg, uint64_t *offset, uint64_t *length) {
+	char *end;
+	if (parseNumber(arg, &end, offset) == -1 || *end != ':') {
+		return -1;
+	}
+	if (parseNumber(end + 1, &end, length) == -1 || *end != '\0') {
+		return -1;
+	}
+	if (*length > UINT64_MAX - *offset) {
+		return -1;
+	}
+	return 0;
+}
 
 int main (int argc, char *argv[]) {
-	int i;
 	int in_file, out_file;
 	/* Flag to indicate if input/output is stdin/stdout or not */
 	int is_stdin, is_stdout;
-	/* The total number of characters in the original file */
-	uint8_t ascii;
-	uint32_t freq;
-	struct stat file_info;
+	/* Format version of the input file */
+	int version;
+	/* Set for either blocked format */
+	int blocked;
+	/* Buffered reader and writer for the input and output files */
+	BufReader *in;
+	BufWriter *out;
 	Node *tree;
+	/* Lookup table used to decode the body */
+	DecodeTable *table;
 	LinkedList *llst;
 	FrequencyTable *freq_table; 
+	int opt;
+	/* Set when an unknown option is given */
+	int bad_option = 0;
+	/* Number of threads decoding blocks, 0 for one per CPU */
+	int threads = 0;
+	/* Number of file names given */
+	int nargs;
+	struct stat file_info;
+	/* Report printed to stderr by --stats, NULL when not asked for */
+	Stats *stats = NULL;
+	/* Set when --range asks for only part of the output */
+	int ranged = 0;
+	uint64_t range_offset = 0, range_length = 0;
+	int64_t status;
+	/* Table given by -D, NULL when none was */
+	Dictionary *dict = NULL;
+	/* Threads decoding a single body, set when it is large enough */
+	SyncJob *job;
+
+	while ((opt = getopt_long(argc, argv, "T:D:", long_options, NULL)) 
+			!= -1) {
+		switch (opt) {
+			case 'T':
+				threads = atoi(optarg);
+				break;
+			case 'D':
+				dict = loadDict(optarg);
+				break;
+			case 'S':
+				stats = makeStats("hdecode");
+				break;
+			case 'R':
+				if (parseRange(optarg, &range_offset, 
+						&range_length) == -1) {
+					fprintf(stderr, "%s: bad range %s\n",
+						argv[0], optarg);
+					exit(EXIT_FAILURE);
+				}
+				ranged = 1;
+				break;
+			default:
+				bad_option = 1;
+		}
+	}
+	nargs = bad_option ? -1 : argc - optind;
+
 	/* Input taken from stdin and output goes to stdout */
-	if (argc == 1) {
+	if (nargs == 0) {
 		in_file = fileno(stdin);
 		is_stdin = 1;
 		out_file = fileno(stdout);
@@ -33,17 +129,17 @@ int main (int argc, char *argv[]) {
 	}
 	/* Input taken from stdin if file name is "-" 
 	 * Output goes to stdout regardless */
-	else if (argc == 2) {
-		if (strcmp("-", argv[1]) == 0) {
+	else if (nargs == 1) {
+		if (strcmp("-", argv[optind]) == 0) {
 			in_file = fileno(stdin);
 			is_stdin = 1;
 		}
 		else {
 			/* Opens input file in read only mode */
-			in_file = open(argv[1], O_RDONLY);
+			in_file = open(argv[optind], O_RDONLY);
 			/* open returns -1 on error */
 			if (in_file == -1) {
-				perror(argv[1]);
+				perror(argv[optind]);
 				exit(EXIT_FAILURE);
 			}
 			is_stdin = 0;
@@ -52,16 +148,16 @@ int main (int argc, char *argv[]) {
 		is_stdout = 1;
 	}
 	/* Output goes to the outfile */
-	else if (argc == 3) {
-		if (strcmp("-", argv[1]) == 0) {
+	else if (nargs == 2) {
+		if (strcmp("-", argv[optind]) == 0) {
 			in_file = fileno(stdin);
 			is_stdin = 1;
 		}
 		else {
-			in_file = open(argv[1], O_RDONLY);
+			in_file = open(argv[optind], O_RDONLY);
 			/* open returns -1 on error */
 			if (in_file == -1) {
-				perror(argv[1]);
+				perror(argv[optind]);
 				exit(EXIT_FAILURE);
 			}
 			is_stdin = 0;
@@ -70,78 +166,187 @@ int main (int argc, char *argv[]) {
 		 * O_CREAT for creating the file if it doens't exist 
 		 * O_TRUNC for clearing it if already exists 
 		 * S_IRWXU gives the user read, write, and execute perms. */
-		out_file = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU);
+		out_file = open(argv[optind + 1], 
+				O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU);
 		/* Error handling for output file goes here */
 		is_stdout = 0;
 	}
 	/* Print usage and exit */
 	else {
-		fprintf(stderr, "usage: %s [ ( infile | - ) [ outfile ] ]\n", 
-				argv[0]);
+		fprintf(stderr, "usage: %s [ -T threads ] [ -D table ] "
+				"[ --stats ] "
+				"[ --range offset:length ] "
+				"[ ( infile | - ) [ outfile ] ]\n", argv[0]);
 		exit(EXIT_FAILURE);
 	}
 
-	/* Get the file size. Size will be stored in st_size attribute of 
-	 * stat struct that is was assigned to size_buffer */
-	if (fstat(in_file, &file_info)) {
-		perror("fstat");
+	/* A regular file is mapped so that the blocks of a blocked file 
+	 * can be found through its index and decoded in parallel. Pipes
+	 * are read through a buffer, with the next buffer read while this 
+	 * one is decoded. The output is written in the background in the
+	 * same way. */
+	in = NULL;
+	if (fstat(in_file, &file_info) == 0 && S_ISREG(file_info.st_mode)
+			&& file_info.st_size > 0) {
+		in = mapReader(in_file, file_info.st_size);
+	}
+	if (!in) {
+		in = makeAsyncReader(in_file, BUF_SIZE);
 	}
-	/* Empty file */
-	if (file_info.st_size == 0) {
+	out = makeAsyncWriter(out_file, BUF_SIZE);
+
+	/* Empty file. Checked by trying to fill the buffer rather than with
+	 * fstat so that pipes on stdin work too. */
+	if (readerFill(in) == 0) {
+		readerDestroy(in);
+		writerDestroy(out);
 		if (!is_stdin) {
 			close(in_file);
 		}
 		if (!is_stdout) {
 			close(out_file);
 		}
+		statsPrint(stats, stderr);
 		exit(EXIT_SUCCESS);
 	}
 
-	freq_table = makeFreqTable();
-	/* Start reading the header */
-	/* Read the first byte which is the number of unique characters - 1 */
-	read(in_file, &freq_table->unique_count, sizeof(uint8_t));
-	
-	/* Increment unique_count by 1 */
-	freq_table->unique_count += 1;
-	
-	/* Reconstruct the frequency table based on the header. Number of
-	 * times looped is based on the unique_count. Once this loop finishes,
-	 * the entire header has been read and the file pointer is at the 
+	/* Read the header. Once it has been read, the reader is at the
 	 * beginning of the body. */
-	for (i = 0; i < freq_table->unique_count; i++) {
-		/* The header follows the sequence: 
-		 * - character: an unsigned integer of size 1 byte
-		 * - frequency: an unsigned integer of size 4 bytes */
-		/* Gets the character from the header */
-		read(in_file, &ascii, sizeof(uint8_t));
-		/* Gets the frequency of the char. just read from header
-		 * Puts it into count variable first so that it can be
-		 * converted to network byte order */
-		read(in_file, &freq, sizeof(uint32_t));
-		freq = htonl(freq);
-		freq_table->freq[ascii] = freq;
-		freq_table->count += freq;
-	}
-
-	/* Start regenerating the tree */
-	/* Build a linked list from the frequency table */
-	llst = createList(freq_table);
-
-	/* Build the tree from the linked list */
-	tree = buildTree(llst);
-
-	/* Case where there is only one total character */
-	if (freq_table->count == 1) {
-		write(out_file, &tree->ascii, sizeof(char));
-		exit(EXIT_SUCCESS);
+	statsPhase(stats, "header");
+	freq_table = makeFreqTable();
+	if (!freq_table) {
+		perror("malloc FrequencyTable");
+		exit(EXIT_FAILURE);
+	}
+	version = readHeader(in, freq_table);
+	blocked = version == VERSION_BLOCKED || version == VERSION_INTERLEAVED;
+
+	tree = NULL;
+	llst = NULL;
+	table = NULL;
+	/* Only the blocks holding the range are decoded, found through
+	 * the index at the end of the file */
+	if (ranged && (!blocked || !in->fixed)) {
+		fprintf(stderr, "--range needs a blocked file (hencode -T or "
+				"-B) that is not read from a pipe\n");
+		exit(EXIT_FAILURE);
+	}
+	if (blocked) {
+		statsMode(stats, version == VERSION_BLOCKED ? "blocked" :
+				"interleaved");
+		statsPhase(stats, "blocks");
+	}
+	else if (version == VERSION_ADAPTIVE) {
+		statsMode(stats, "adaptive");
+		statsPhase(stats, "adaptive");
+	}
+	else if (version == VERSION_DICT) {
+		statsMode(stats, "dict");
+		statsPhase(stats, "table");
+		/* The code lengths come from the table the file was written
+		 * with, which the header only names */
+		if (!dict) {
+			fprintf(stderr, "file was written with a table, give "
+					"it with -D\n");
+			exit(EXIT_FAILURE);
+		}
+		status = readDictHeader(in, dict, freq_table);
+		if (status == DICT_MISMATCH) {
+			fprintf(stderr, "file was written with another "
+					"table\n");
+			exit(EXIT_FAILURE);
+		}
+		if (status == -1) {
+			fprintf(stderr, "invalid or truncated header\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	else {
+		statsMode(stats, version == VERSION_LEGACY ? "legacy" : 
+				"canon");
+		statsPhase(stats, "table");
+	}
+	if (ranged) {
+		status = decompressRange(in->buf, in->len, range_offset,
+					range_length, out);
+		if (status == RANGE_PAST_END) {
+			fprintf(stderr, "range starts past the end of the "
+					"file\n");
+			exit(EXIT_FAILURE);
+		}
+		if (status == -1) {
+			fprintf(stderr, "invalid block index\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	else if (blocked && in->fixed) {
+		/* Every block carries its own code lengths, so blocks are
+		 * decoded in parallel */
+		decompressBlocksParallel(in, out, poolThreads(threads));
 	}
+	else if (blocked) {
+		decompressBlocks(in, out, version);
+	}
+	else if (version == VERSION_ADAPTIVE) {
+		/* The tree is rebuilt symbol by symbol as the body is read */
+		adaptiveDecode(in, out);
+	}
+	else if (version == VERSION_LEGACY) {
+		/* Start regenerating the tree */
+		/* Build a linked list from the frequency table */
+		llst = createList(freq_table);
 
-	/* Generate codes for each present character */
-	freq_table->codes = genCodes(tree, freq_table->codes, "");
+		/* Build the tree from the linked list */
+		tree = buildTree(llst);
 
-	/* Traverse tree to decode the encoded file */
-	decode(in_file, out_file, tree, freq_table);
+		/* Flatten the tree into a lookup table to decode the 
+		 * encoded file. A tree that is a single leaf, including a
+		 * file of one char., decodes without using any bits. */
+		table = makeDecodeTable(tree);
+		if (!table) {
+			perror("malloc DecodeTable");
+			exit(EXIT_FAILURE);
+		}
+		/* The codes are only needed for the code lengths in the
+		 * report */
+		if (stats) {
+			genCodes(tree, freq_table->codes, 0, 0);
+		}
+	}
+	else {
+		/* Canonical codes, the table comes straight from the 
+		 * code lengths */
+		table = makeLengthsTable(freq_table);
+		if (!table) {
+			perror("malloc DecodeTable");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (table) {
+		statsPhase(stats, "body");
+		/* A single body held in memory is cut into chunks that are
+		 * decoded in parallel from wherever they start */
+		if (in->fixed && !freq_table->stored && poolThreads(threads) > 1
+				&& in->len - in->pos >= 2 * SYNC_CHUNK) {
+			job = makeSyncJob(in->buf + in->pos, in->len - in->pos,
+					table, freq_table->count, 
+					poolThreads(threads));
+			status = syncDecode(job, out);
+			syncJobDestroy(job);
+		}
+		else {
+			status = decode(in, out, table, freq_table);
+		}
+		if (status == -1) {
+			fprintf(stderr, "unexpected end of body\n");
+			exit(EXIT_FAILURE);
+		}
+		dtableDestroy(table);
+		statsCodes(stats, freq_table);
+	}
+	writerDestroy(out);
+	readerDestroy(in);
+	statsPhase(stats, NULL);
 
 	/* Close files */
 	if (!is_stdin) {
@@ -155,6 +360,9 @@ int main (int argc, char *argv[]) {
 	ftableDestroy(freq_table);
 	treeDestroy(tree);
 	free(llst);
+	free(dict);
+	statsPrint(stats, stderr);
+	statsDestroy(stats);
 
 	return 0;
 }
@@ -3,57 +3,237 @@
 #include <string.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include "freq.h"
 #include "llist.h"
 #include "filerw.h"
+#include "bufio.h"
+#include "canon.h"
+#include "block.h"
+#include "pool.h"
+#include "adaptive.h"
+#include "stats.h"
+#include "batch.h"
+#include "dict.h"
+#include "split.h"
+
+/* Long options, which have no single letter form */
+static struct option long_options[] = {
+	{ "stats", no_argument, NULL, 'S' },
+	{ NULL, 0, NULL, 0 }
+};
 
 int main(int argc, char *argv[]) {
 	/* The size of the input file */
-	int file_size;
+	uint64_t file_size;
 	int in_file, out_file;
-	/* Flag to indicate if output is stdout or not */
-	int is_stdout;
+	/* Flag to indicate if input/output is stdin/stdout or not */
+	int is_stdin, is_stdout;
+	/* Set when the input has to be read in a single pass */
+	int streaming;
 	/* Buffer to hold the size of a file after using fstat */
 	struct stat size_buffer;
-	Node *tree;
-	LinkedList *llst;
+	/* Buffered reader and writer for the input and output files */
+	BufReader *in;
+	BufWriter *out;
 	FrequencyTable *freq_table; 
+	int opt;
+	/* Set when an unknown option is given */
+	int bad_option = 0;
+	/* Set when -T, -B or -I asks for the blocked format */
+	int blocked = 0;
+	/* Number of threads counting or compressing, 0 for one per CPU */
+	int threads = 0;
+	/* Number of input bytes in each block */
+	size_t block_size = DEFAULT_BLOCK_SIZE;
+	/* Number of interleaved streams in each block given by -I */
+	int nstreams = 1;
+	/* Set when -A asks for single pass adaptive codes */
+	int adaptive = 0;
+	/* Longest code allowed by -L, 0 for no limit */
+	int max_len = 0;
+	/* Report printed to stderr by --stats, NULL when not asked for */
+	Stats *stats = NULL;
+	/* Set when -b compresses a list or directory of files */
+	int batch = 0;
+	/* Set when -B or -I is given, which batches don't support */
+	int sized = 0;
+	FileList *files;
+	/* Table given by -D, NULL when none was */
+	Dictionary *dict = NULL;
+	size_t failed;
+	/* Set when -P encodes a single body with several threads */
+	int split = 0;
+	SplitJob *job;
 
-	/* Output goes to stdout */
-	if (argc == 2) {
-		/* Opens input file in read only mode */
-		in_file = open(argv[1], O_RDONLY);
-		/* open returns -1 on error */
-		if (in_file == -1) {
-			perror(argv[1]);
+	while ((opt = getopt_long(argc, argv, "T:B:I:P:AL:bD:", long_options, 
+					NULL)) != -1) {
+		switch (opt) {
+			case 'T':
+				threads = atoi(optarg);
+				blocked = 1;
+				break;
+			case 'B':
+				block_size = parseSize(optarg);
+				if (block_size == 0 || 
+					block_size > MAX_BLOCK_SIZE) {
+					fprintf(stderr, "%s: bad block size "
+						"%s\n", argv[0], optarg);
+					exit(EXIT_FAILURE);
+				}
+				blocked = 1;
+				sized = 1;
+				break;
+			case 'I':
+				nstreams = atoi(optarg);
+				if (nstreams < 2 || nstreams > MAX_STREAMS) {
+					fprintf(stderr, "%s: streams must be 2 "
+						"to %d\n", argv[0], MAX_STREAMS);
+					exit(EXIT_FAILURE);
+				}
+				blocked = 1;
+				sized = 1;
+				break;
+			case 'P':
+				threads = atoi(optarg);
+				split = 1;
+				break;
+			case 'A':
+				adaptive = 1;
+				break;
+			case 'L':
+				max_len = atoi(optarg);
+				if (max_len < MIN_CODE_LIMIT || 
+					max_len > MAX_CODE_LEN) {
+					fprintf(stderr, "%s: code length limit "
+						"must be %d to %d\n", argv[0],
+						MIN_CODE_LIMIT, MAX_CODE_LEN);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'S':
+				stats = makeStats("hencode");
+				break;
+			case 'b':
+				batch = 1;
+				break;
+			case 'D':
+				dict = loadDict(optarg);
+				break;
+			default:
+				bad_option = 1;
+		}
+	}
+
+	/* The body is written as a single stream, so there are no blocks
+	 * to pick a size or format for */
+	if (split && (adaptive || blocked || dict || batch)) {
+		fprintf(stderr, "%s: -P can't be used with -A, -T, -B, -I, -D "
+			"or -b\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	/* Every file named by a list or found in a directory is compressed
+	 * to its own sibling, spread across -T threads */
+	else if (batch && !bad_option && argc - optind == 1) {
+		if (adaptive || sized || dict) {
+			fprintf(stderr, "%s: -b can't be used with -A, -B, -I "
+				"or -D\n", argv[0]);
 			exit(EXIT_FAILURE);
 		}
+		files = makeFileList();
+		if (stat(argv[optind], &size_buffer) == 0 && 
+			S_ISDIR(size_buffer.st_mode)) {
+			if (readDirectory(files, argv[optind]) == -1) {
+				perror(argv[optind]);
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (readFileList(files, argv[optind]) == -1) {
+			perror(argv[optind]);
+			exit(EXIT_FAILURE);
+		}
+		failed = compressBatch(files, poolThreads(threads), max_len);
+		if (failed > 0) {
+			fprintf(stderr, "%s: %zu of %zu files failed\n", argv[0],
+				failed, files->count);
+		}
+		fileListDestroy(files);
+		exit(failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+	/* A table fixes the codes, so nothing else about them can be
+	 * chosen */
+	else if (dict && (adaptive || blocked || max_len)) {
+		fprintf(stderr, "%s: -D can't be used with -A, -T, -B, -I or "
+			"-L\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	/* Adaptive codes grow as the input goes by, in a single stream with
+	 * no code lengths to limit */
+	else if (adaptive && (blocked || max_len)) {
+		fprintf(stderr, "%s: -A can't be used with -T, -B, -I or -L\n",
+			argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	/* Output goes to stdout */
+	else if (!batch && !bad_option && argc - optind == 1) {
+		/* Input taken from stdin if file name is "-" */
+		if (strcmp("-", argv[optind]) == 0) {
+			in_file = fileno(stdin);
+			is_stdin = 1;
+		}
+		else {
+			/* Opens input file in read only mode */
+			in_file = open(argv[optind], O_RDONLY);
+			/* open returns -1 on error */
+			if (in_file == -1) {
+				perror(argv[optind]);
+				exit(EXIT_FAILURE);
+			}
+			is_stdin = 0;
+		}
 		out_file = fileno(stdout);
 		is_stdout = 1;
 	}
 	/* Output goes to the outfile */
-	else if (argc == 3) {
-		in_file = open(argv[1], O_RDONLY);
-		/* open returns -1 on error */
-		if (in_file == -1) {
-			perror(argv[1]);
-			exit(EXIT_FAILURE);
+	else if (!batch && !bad_option && argc - optind == 2) {
+		if (strcmp("-", argv[optind]) == 0) {
+			in_file = fileno(stdin);
+			is_stdin = 1;
+		}
+		else {
+			in_file = open(argv[optind], O_RDONLY);
+			/* open returns -1 on error */
+			if (in_file == -1) {
+				perror(argv[optind]);
+				exit(EXIT_FAILURE);
+			}
+			is_stdin = 0;
 		}
 		/* Opens output file for writing.
 		 * O_CREAT for creating the file if it doens't exist 
 		 * O_TRUNC for clearing it if already exists 
-		 * S_IRWXU gives the user read, write, and execute perms. */
-		out_file = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU);
+		 * S_IRWXU gives the user read, write, and execute perms.
+		 * It is opened for reading too so that -P can map it. */
+		out_file = open(argv[optind + 1], 
+				O_RDWR | O_CREAT | O_TRUNC, S_IRWXU);
 		/* Error handling not needed for output file because if it 
 		 * doesn't exist, it will be created */
 		is_stdout = 0;
 	}
 	/* Print usage and exit */
 	else {
-		fprintf(stderr, "usage %s infile [ outfile ]\n", argv[0]);
+		fprintf(stderr, "usage %s [ -A | -T threads | -P threads ] "
+				"[ -B blocksize ] "
+				"[ -I streams ] [ -L maxbits ] [ --stats ] "
+				"( infile | - ) [ outfile ]\n"
+				"      %s -D table [ --stats ] ( infile | - ) "
+				"[ outfile ]\n"
+				"      %s -b [ -T threads ] [ -L maxbits ] "
+				"( listfile | directory | - )\n", argv[0], argv[0],
+				argv[0]);
 		exit(EXIT_FAILURE);
 	}
 
@@ -61,51 +241,184 @@ int main(int argc, char *argv[]) {
 	 * stat struct that was assigned to size_buffer */
 	if (fstat(in_file, &size_buffer)) {
 		perror("fstat");
+		exit(EXIT_FAILURE);
 	}
 	file_size = size_buffer.st_size;
+	/* Anything but a regular file, such as a pipe, has no size up front
+	 * and can't be read twice. It is compressed as a stream of blocks,
+	 * read one block at a time without ever seeking. */
+	streaming = !S_ISREG(size_buffer.st_mode);
+	/* The count goes in the header ahead of the body */
+	if (dict && streaming) {
+		fprintf(stderr, "%s: -D needs a regular file as input\n",
+			argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	/* Chunks are encoded out of order, so all of the input must be
+	 * there up front */
+	if (split && streaming) {
+		fprintf(stderr, "%s: -P needs a regular file as input\n",
+			argv[0]);
+		exit(EXIT_FAILURE);
+	}
 	
 	/* Empty file */
-	if (file_size == 0) {
-		close(in_file);
+	if (!streaming && file_size == 0) {
+		if (!is_stdin) {
+			close(in_file);
+		}
 		if (!is_stdout) {
 			close(out_file);
 		}
+		statsPrint(stats, stderr);
 		exit(EXIT_SUCCESS);
 	}
 
-	/* Make a frequency table and get each character's frequency 
-	 * from the file */
-	freq_table = makeFreqTable();
-	genFreq(in_file, file_size, freq_table);
-	/* Set the file pointer back to the beginning since genFreq moved
-	 * it to the end */
-	if(lseek(in_file, 0, SEEK_SET) == -1) {
-		perror("lseek");
-		exit(EXIT_FAILURE);
+	/* Regular files are mapped so that both passes below run over the
+	 * file's pages directly. Anything that can't be mapped is streamed
+	 * through a buffer instead, with the next buffer read while this one
+	 * is coded. The output is written in the background in the same 
+	 * way. */
+	in = NULL;
+	if (!streaming) {
+		in = mapReader(in_file, file_size);
+	}
+	if (!in) {
+		in = makeAsyncReader(in_file, BUF_SIZE);
+	}
+	out = makeAsyncWriter(out_file, BUF_SIZE);
+	/* Chunks are encoded straight out of the mapped input */
+	if (split && !in->fixed) {
+		fprintf(stderr, "%s: can't map the input, -P falls back to "
+			"one thread\n", argv[0]);
 	}
-	/* Construct a linked list from the frequencies */
-	llst = createList(freq_table);
 
-	/* Combine all nodes and Construct the tree from the linked list 
-	 * then traverse the tree to get each character's hcode */
-	tree = buildTree(llst);
-	freq_table->codes = genCodes(tree, freq_table->codes, "");
-	
-	/* Write header to output */
-	makeHeader(out_file, freq_table);
-	/* Write body to output */
-	makeBody(in_file, file_size, out_file, freq_table);
+	freq_table = NULL;
+	if (adaptive) {
+		/* Adaptive codes: the input is read once, straight through,
+		 * and coded as it arrives */
+		statsMode(stats, "adaptive");
+		statsPhase(stats, "adaptive");
+		adaptiveEncode(in, out);
+	}
+	else if (dict) {
+		/* The codes come from the table, so the header only names
+		 * it. The input is still counted, so that data the table's
+		 * codes don't shrink is stored and a single repeated char.
+		 * is written as a run, as without a table. */
+		statsMode(stats, "dict");
+		statsPhase(stats, "freq");
+		freq_table = makeFreqTable();
+		if (!freq_table) {
+			perror("malloc FrequencyTable");
+			exit(EXIT_FAILURE);
+		}
+		genFreq(in, file_size, freq_table, poolThreads(threads));
+		readerRewind(in);
+		memcpy(freq_table->lengths, dict->lengths, MAX_NUM_BYTES);
+		memcpy(freq_table->codes, dict->codes, sizeof(dict->codes));
+		chooseMode(freq_table);
+		statsPhase(stats, "header");
+		if (freq_table->stored || freq_table->unique_count == 1) {
+			/* A run has no code lengths, only its char. */
+			if (!freq_table->stored) {
+				memset(freq_table->lengths, 0, MAX_NUM_BYTES);
+			}
+			makeHeader(out, freq_table);
+		}
+		else {
+			makeDictHeader(out, dict, file_size);
+		}
+		statsPhase(stats, "body");
+		makeBody(in, file_size, out, freq_table);
+		statsCodes(stats, freq_table);
+	}
+	else if (split && in->fixed) {
+		/* A single body as the canonical format writes it, with
+		 * every thread encoding its own chunks straight into place */
+		statsMode(stats, "split");
+		statsPhase(stats, "freq");
+		freq_table = makeFreqTable();
+		if (!freq_table) {
+			perror("malloc FrequencyTable");
+			exit(EXIT_FAILURE);
+		}
+		job = makeSplitJob(in->buf, file_size, poolThreads(threads));
+		splitCount(job, freq_table);
+		statsPhase(stats, "tree");
+		makeLengths(freq_table, max_len);
+		statsPhase(stats, "codes");
+		canonCodes(freq_table->lengths, freq_table->codes);
+		chooseMode(freq_table);
+		statsPhase(stats, "header");
+		makeHeader(out, freq_table);
+		statsPhase(stats, "body");
+		if (!splitEncode(job, freq_table, out)) {
+			fprintf(stderr, "%s: can't map the output, -P builds "
+				"the body in memory\n", argv[0]);
+		}
+		splitJobDestroy(job);
+		statsCodes(stats, freq_table);
+	}
+	else if (blocked || streaming) {
+		/* Blocked format: each block is compressed on its own by a
+		 * pool of threads */
+		statsMode(stats, nstreams > 1 ? "interleaved" : "blocked");
+		statsPhase(stats, "blocks");
+		compressBlocks(in, out, block_size, poolThreads(threads),
+				max_len, nstreams);
+	}
+	else {
+		statsMode(stats, "canon");
+		/* Make a frequency table and get each character's frequency 
+		 * from the file */
+		statsPhase(stats, "freq");
+		freq_table = makeFreqTable();
+		if (!freq_table) {
+			perror("malloc FrequencyTable");
+			exit(EXIT_FAILURE);
+		}
+		genFreq(in, file_size, freq_table, poolThreads(threads));
+		/* Set the file pointer back to the beginning since genFreq
+		 * moved it to the end. For a mapped file this is only a
+		 * position reset. */
+		readerRewind(in);
+		/* Build the tree and get each character's code length. Only
+		 * the depth of each leaf is kept from the tree. */
+		statsPhase(stats, "tree");
+		makeLengths(freq_table, max_len);
+		/* The codes themselves are the canonical codes for those
+		 * lengths, so the header only needs to carry the lengths. */
+		statsPhase(stats, "codes");
+		canonCodes(freq_table->lengths, freq_table->codes);
+		/* Data that won't get smaller is stored as it is */
+		chooseMode(freq_table);
+
+		/* Write header to output */
+		statsPhase(stats, "header");
+		makeHeader(out, freq_table);
+		/* Write body to output */
+		statsPhase(stats, "body");
+		makeBody(in, file_size, out, freq_table);
+		statsCodes(stats, freq_table);
+	}
+	/* Write out whatever is still buffered */
+	writerDestroy(out);
+	readerDestroy(in);
 	
-	/* Close input file */
-	close(in_file);
+	/* Close input file only if input wasn't stdin */
+	if (!is_stdin) {
+		close(in_file);
+	}
 	/* Close output file only if output wasn't stdout */
 	if (!is_stdout) {
 		close (out_file);
 	}
 	/* Free all dynamically allocated structs */
 	ftableDestroy(freq_table);
-	treeDestroy(tree);
-	free(llst);
+	free(dict);
+	statsPrint(stats, stderr);
+	statsDestroy(stats);
 	return 0;
 }
 
@@ -0,0 +1,391 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "freq.h"
+#include "bufio.h"
+#include "canon.h"
+#include "dtable.h"
+#include "filerw.h"
+#include "dict.h"
+#include "huff.h"
+#include "hstream.h"
+
+/* Creates a stream ready for the first byte of a buffer. Returns NULL
+ * if it can't be allocated. */
+HuffStream *makeHuffStream(void) {
+	HuffStream *stream = malloc(sizeof(HuffStream));
+	if (!stream) {
+		return NULL;
+	}
+	stream->has_dict = 0;
+	huffStreamReset(stream);
+	return stream;
+}
+
+/* Readies a stream for the next buffer. A table set by huffStreamUseDict
+ * is kept. */
+void huffStreamReset(HuffStream *stream) {
+	stream->state = STREAM_HEADER;
+	stream->error = HUFF_OK;
+	stream->header_len = 0;
+	stream->acc = 0;
+	stream->nbits = 0;
+	stream->code = 0;
+	stream->code_len = 0;
+}
+
+/* Gives a stream a table written by htrain, for buffers written with
+ * huffUseDict or hencode -D. A table of NULL drops the stream's table.
+ * Returns HUFF_OK, or HUFF_ERR_FORMAT if table is not a valid table. */
+int huffStreamUseDict(HuffStream *stream, const void *table, size_t n) {
+	BufReader in;
+
+	stream->has_dict = 0;
+	if (!table) {
+		return HUFF_OK;
+	}
+	initMemReader(&in, table, n);
+	if (readDict(&in, &stream->dict) == -1) {
+		return HUFF_ERR_FORMAT;
+	}
+	stream->has_dict = 1;
+	return HUFF_OK;
+}
+
+/* Reads a varint count from the header bytes starting at pos. Returns
+ * the number of header bytes the header needs so far: just past the
+ * varint once it is all there, or one more than have been received. */
+static size_t varintNeed(const HuffStream *stream, size_t pos) {
+	while (pos < stream->header_len) {
+		if (!(stream->header[pos++] & 0x80)) {
+			return pos;
+		}
+	}
+	return pos + 1;
+}
+
+/* Returns how many bytes the header takes, as far as can be told from
+ * the bytes received so far. Once that many have been received it is
+ * the size of the whole header, so that the body's first byte is never
+ * taken as part of the header. The magic bytes and version must have
+ * been checked. */
+static size_t headerNeed(const HuffStream *stream) {
+	const uint8_t *header = stream->header;
+	int version = header[MAGIC_LEN];
+	size_t pos = MAGIC_LEN + 1;
+	int max_len, lo, hi;
+
+	if (version == VERSION_DICT) {
+		pos += sizeof(uint32_t);
+		return pos > stream->header_len ? pos :
+				varintNeed(stream, pos);
+	}
+	if (version == VERSION_CANON) {
+		pos += sizeof(uint32_t);
+	}
+	else {
+		pos = varintNeed(stream, pos);
+	}
+	if (pos >= stream->header_len) {
+		return pos + 1;
+	}
+	max_len = header[pos++];
+	if (max_len == MODE_STORED) {
+		return pos;
+	}
+	if (pos + 2 > stream->header_len) {
+		return pos + 2;
+	}
+	lo = header[pos];
+	hi = header[pos + 1];
+	pos += 2;
+	/* A run has no lengths. When lo > hi the header is invalid, which
+	 * reading it finds. */
+	if (max_len == MODE_RUN || lo > hi) {
+		return pos;
+	}
+	return pos + (max_len <= NIBBLE_MAX ? (hi - lo + 2) / 2 :
+			hi - lo + 1);
+}
+
+/* Sets up the tables the body is decoded with from the code lengths.
+ * Codes of up to fast_bits bits are found with one lookup; longer ones
+ * are read a bit at a time and checked against the first code of each
+ * length, which needs no table that grows with the code. */
+static void loadStreamCodes(HuffStream *stream) {
+	const uint8_t *lengths = stream->freq_table.lengths;
+	Code codes[MAX_NUM_BYTES];
+	size_t span, first, k;
+	uint64_t code = 0;
+	int len, c, n = 0;
+
+	canonCodes(lengths, codes);
+	memset(stream->len_count, 0, sizeof(stream->len_count));
+	stream->max_len = 0;
+	for (c = 0; c < MAX_NUM_BYTES; c++) {
+		stream->len_count[lengths[c]] += 1;
+		if (lengths[c] > stream->max_len) {
+			stream->max_len = lengths[c];
+		}
+	}
+	stream->len_count[0] = 0;
+	/* The same walk as canonCodes, keeping the first code of each
+	 * length */
+	for (len = 1; len <= MAX_CODE_LEN; len++) {
+		code = (code + stream->len_count[len - 1]) << 1;
+		stream->first[len] = code;
+		stream->len_index[len] = n;
+		for (c = 0; c < MAX_NUM_BYTES; c++) {
+			if (lengths[c] == len) {
+				stream->syms[n++] = c;
+			}
+		}
+	}
+
+	stream->fast_bits = stream->max_len > DT_BITS ? DT_BITS :
+			stream->max_len;
+	memset(stream->fast, 0, sizeof(stream->fast));
+	for (c = 0; c < MAX_NUM_BYTES; c++) {
+		if (lengths[c] == 0 || lengths[c] > stream->fast_bits) {
+			continue;
+		}
+		span = (size_t)1 << (stream->fast_bits - lengths[c]);
+		first = codes[c].bits << (stream->fast_bits - lengths[c]);
+		for (k = 0; k < span; k++) {
+			stream->fast[first + k] = c | lengths[c] << 8;
+		}
+	}
+}
+
+/* Reads the complete header and gets ready for the body. Returns
+ * HUFF_OK or an HUFF_ERR code. */
+static int startBody(HuffStream *stream) {
+	FrequencyTable *freq_table = &stream->freq_table;
+	int version = stream->header[MAGIC_LEN];
+	BufReader in;
+	int status;
+
+	initMemReader(&in, stream->header + MAGIC_LEN + 1,
+			stream->header_len - MAGIC_LEN - 1);
+	memset(freq_table, 0, sizeof(FrequencyTable));
+	freq_table->size = MAX_NUM_BYTES;
+	if (version == VERSION_CANON) {
+		status = readLengths(&in, freq_table);
+	}
+	else if (version == VERSION_WIDE) {
+		status = readWideLengths(&in, freq_table);
+	}
+	else {
+		status = readDictHeader(&in, &stream->dict, freq_table);
+		if (status == DICT_MISMATCH) {
+			return HUFF_ERR_DICT;
+		}
+	}
+	if (status == -1) {
+		return HUFF_ERR_CORRUPT;
+	}
+	stream->left = freq_table->count;
+	stream->state = stream->left == 0 ? STREAM_DONE : STREAM_BODY;
+	if (freq_table->unique_count == 1) {
+		stream->run = 0;
+		while (freq_table->freq[stream->run] == 0) {
+			stream->run++;
+		}
+	}
+	else if (!freq_table->stored) {
+		loadStreamCodes(stream);
+	}
+	return HUFF_OK;
+}
+
+/* Takes header bytes from the input, never more than the header needs,
+ * and reads the header once it is all there. Returns the number of
+ * bytes taken, or an HUFF_ERR code. */
+static int64_t feedHeader(HuffStream *stream, const uint8_t *src,
+		size_t n) {
+	size_t taken = 0;
+	size_t need, chunk;
+	int version, status;
+
+	while (stream->state == STREAM_HEADER) {
+		need = MAGIC_LEN + 1;
+		if (stream->header_len >= need) {
+			version = stream->header[MAGIC_LEN];
+			if (memcmp(stream->header, HUFF_MAGIC, MAGIC_LEN) != 0
+					|| (version != VERSION_CANON &&
+					version != VERSION_WIDE &&
+					version != VERSION_DICT)) {
+				return HUFF_ERR_FORMAT;
+			}
+			if (version == VERSION_DICT && !stream->has_dict) {
+				return HUFF_ERR_DICT;
+			}
+			need = headerNeed(stream);
+			if (need > HUFF_HEADER_MAX) {
+				return HUFF_ERR_CORRUPT;
+			}
+		}
+		if (stream->header_len == need) {
+			status = startBody(stream);
+			if (status != HUFF_OK) {
+				return status;
+			}
+			break;
+		}
+		if (taken == n) {
+			break;
+		}
+		chunk = need - stream->header_len;
+		if (chunk > n - taken) {
+			chunk = n - taken;
+		}
+		memcpy(stream->header + stream->header_len, src + taken, chunk);
+		stream->header_len += chunk;
+		taken += chunk;
+	}
+	return taken;
+}
+
+/* Decodes as much of the body as the input and the room in dst allow.
+ * Stored bodies are copied and runs are written without any input.
+ * Returns the number of input bytes taken. */
+static size_t feedBody(HuffStream *stream, const uint8_t *src, size_t n,
+		uint8_t *dst, size_t cap, size_t *produced) {
+	size_t taken = 0;
+	size_t out = *produced;
+	size_t chunk;
+	uint64_t index;
+	uint16_t entry;
+	int len;
+
+	if (stream->freq_table.stored || stream->freq_table.unique_count == 1) {
+		chunk = cap - out;
+		if (chunk > stream->left) {
+			chunk = stream->left;
+		}
+		if (stream->freq_table.stored) {
+			if (chunk > n) {
+				chunk = n;
+			}
+			memcpy(dst + out, src, chunk);
+			taken = chunk;
+		}
+		else {
+			memset(dst + out, stream->run, chunk);
+		}
+		out += chunk;
+		stream->left -= chunk;
+	}
+	while (stream->left > 0 && out < cap && !stream->freq_table.stored
+			&& stream->freq_table.unique_count != 1) {
+		if (stream->code_len == 0) {
+			entry = stream->fast[stream->acc >> 
+					(64 - stream->fast_bits)];
+			len = entry >> 8;
+			if (len > 0) {
+				/* Bits past nbits are zeros, but a code that
+				 * fits in nbits is found all the same */
+				if (len <= stream->nbits) {
+					dst[out++] = entry & 0xff;
+					stream->acc <<= len;
+					stream->nbits -= len;
+					stream->left -= 1;
+					continue;
+				}
+				if (taken == n) {
+					break;
+				}
+				stream->acc |= (uint64_t)src[taken++] << 
+						(56 - stream->nbits);
+				stream->nbits += 8;
+				continue;
+			}
+		}
+		/* A long code, read a bit at a time */
+		if (stream->nbits == 0) {
+			if (taken == n) {
+				break;
+			}
+			stream->acc = (uint64_t)src[taken++] << 56;
+			stream->nbits = 8;
+		}
+		stream->code = stream->code << 1 | stream->acc >> 63;
+		stream->acc <<= 1;
+		stream->nbits -= 1;
+		stream->code_len += 1;
+		len = stream->code_len;
+		index = stream->code - stream->first[len];
+		if (index < stream->len_count[len]) {
+			dst[out++] = stream->syms[stream->len_index[len] + index];
+			stream->code = 0;
+			stream->code_len = 0;
+			stream->left -= 1;
+		}
+		else if (len >= stream->max_len) {
+			stream->error = HUFF_ERR_CORRUPT;
+			break;
+		}
+	}
+	if (stream->left == 0) {
+		stream->state = STREAM_DONE;
+	}
+	*produced = out;
+	return taken;
+}
+
+/* Decodes the next piece of a buffer written by huffCompress, or of a
+ * file written by hencode without blocks or adaptive codes. The input
+ * can be cut anywhere, even within the header or a code, and the
+ * output is written as far as dst has room; whatever could not be used
+ * yet is kept in the stream for the next call. Bytes after the end of
+ * the buffer are not taken, so buffers sent back to back are decoded
+ * by resetting the stream and passing the rest of the input on.
+ *
+ * Parameters:
+ *  stream - A stream from makeHuffStream
+ *  src - The next bytes of the buffer
+ *  n - The number of bytes in src, which may be 0
+ *  consumed - Set to the number of bytes of src taken. Fewer than n are
+ *             taken only when dst is full or the buffer has ended.
+ *  dst - Where the decompressed bytes go
+ *  cap - The number of bytes dst can hold
+ *  produced - Set to the number of bytes written to dst
+ *
+ * Returns HUFF_STREAM_END once the whole buffer has been written out,
+ * HUFF_OK if more input or more room in dst is needed, or an HUFF_ERR
+ * code, which every later call returns too until the stream is reset.
+ * Input that ends before HUFF_STREAM_END is cut short.
+ */
+int huffStreamDecode(HuffStream *stream, const void *src, size_t n,
+		size_t *consumed, void *dst, size_t cap, size_t *produced) {
+	const uint8_t *bytes = src;
+	int64_t taken;
+
+	*consumed = 0;
+	*produced = 0;
+	if (stream->error != HUFF_OK) {
+		return stream->error;
+	}
+	if (stream->state == STREAM_HEADER) {
+		taken = feedHeader(stream, bytes, n);
+		if (taken < 0) {
+			stream->error = taken;
+			return stream->error;
+		}
+		*consumed = taken;
+	}
+	if (stream->state == STREAM_BODY) {
+		*consumed += feedBody(stream, bytes + *consumed, n - *consumed,
+				dst, cap, produced);
+		if (stream->error != HUFF_OK) {
+			return stream->error;
+		}
+	}
+	return stream->state == STREAM_DONE ? HUFF_STREAM_END : HUFF_OK;
+}
+
+/* Frees a stream */
+void huffStreamDestroy(HuffStream *stream) {
+	free(stream);
+}
@@ -0,0 +1,68 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifndef HSTREAMH
+#define HSTREAMH
+#include "freq.h"
+#include "dtable.h"
+#include "canon.h"
+#include "dict.h"
+#include "huff.h"
+
+/* Where a stream is in its buffer */
+#define STREAM_HEADER 0
+#define STREAM_BODY 1
+#define STREAM_DONE 2
+
+/* HuffStream: Decodes one compressed buffer handed over in pieces of
+ * any size. Everything it keeps between calls is in the struct itself,
+ * so a stream takes sizeof(HuffStream) bytes however large the buffer
+ * is, and never allocates after it is made. */
+typedef struct HuffStream {
+	/* STREAM_HEADER, STREAM_BODY or STREAM_DONE */
+	int state;
+	/* The error every later call returns, HUFF_OK if there was none */
+	int error;
+	/* Header bytes received so far. Only header bytes are taken from
+	 * the input, so nothing past the buffer is ever used up. */
+	uint8_t header[HUFF_HEADER_MAX];
+	size_t header_len;
+	/* Count and code lengths read from the header */
+	FrequencyTable freq_table;
+	/* Chars. still to be written */
+	uint64_t left;
+	/* Char. repeated by a body that is a single run */
+	int run;
+	/* Body bits received and not used yet, left aligned. A byte is only
+	 * taken from the input once a code needs its bits. */
+	uint64_t acc;
+	int nbits;
+	/* Bits of a code longer than fast_bits read so far, right aligned,
+	 * and their number */
+	uint64_t code;
+	int code_len;
+	/* Char. and length of every code of up to fast_bits bits, indexed
+	 * by the next fast_bits bits; 0 where a longer code starts */
+	uint16_t fast[1 << DT_BITS];
+	int fast_bits;
+	/* Longest code */
+	int max_len;
+	/* First canonical code of each length, the number of codes of that
+	 * length and the index in syms of the char. of the first one */
+	uint64_t first[MAX_CODE_LEN + 1];
+	uint16_t len_count[MAX_CODE_LEN + 1];
+	uint16_t len_index[MAX_CODE_LEN + 1];
+	/* Chars. in order of their codes */
+	uint8_t syms[MAX_NUM_BYTES];
+	/* Table set by huffStreamUseDict, used when has_dict is set */
+	Dictionary dict;
+	int has_dict;
+} HuffStream;
+
+HuffStream *makeHuffStream(void);
+void huffStreamReset(HuffStream *);
+int huffStreamUseDict(HuffStream *, const void *, size_t);
+int huffStreamDecode(HuffStream *, const void *, size_t, size_t *, void *,
+		size_t, size_t *);
+void huffStreamDestroy(HuffStream *);
+#endif
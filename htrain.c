@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "freq.h"
+#include "bufio.h"
+#include "canon.h"
+#include "dict.h"
+
+/* Adds the chars. of one sample to the frequency table. A name of "-"
+ * reads the sample from stdin. Exits if the sample can't be read. */
+static void countSample(const char *path, FrequencyTable *freq_table) {
+	int fd = strcmp(path, "-") == 0 ? fileno(stdin) : open(path, O_RDONLY);
+	BufReader *in;
+
+	if (fd == -1) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	in = makeReader(fd, BUF_SIZE);
+	while (readerFill(in) > 0) {
+		countFreq(in->buf, in->len, freq_table);
+		in->pos = in->len;
+	}
+	readerDestroy(in);
+	if (fd != fileno(stdin)) {
+		close(fd);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	FrequencyTable *freq_table;
+	Dictionary dict;
+	BufWriter *out;
+	int out_file;
+	int opt, i;
+	/* Set when an unknown option is given */
+	int bad_option = 0;
+	/* Longest code allowed by -L, 0 for no limit */
+	int max_len = 0;
+	/* Number of bytes in the samples */
+	uint64_t sample_bytes;
+	/* Total code length of the samples */
+	double bits = 0;
+
+	while ((opt = getopt(argc, argv, "L:")) != -1) {
+		switch (opt) {
+			case 'L':
+				max_len = atoi(optarg);
+				if (max_len < MIN_CODE_LIMIT ||
+					max_len > MAX_CODE_LEN) {
+					fprintf(stderr, "%s: code length limit "
+						"must be %d to %d\n", argv[0],
+						MIN_CODE_LIMIT, MAX_CODE_LEN);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			default:
+				bad_option = 1;
+		}
+	}
+	if (bad_option || argc - optind < 2) {
+		fprintf(stderr, "usage: %s [ -L maxbits ] tablefile "
+				"( sample | - )...\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	/* Count the chars. of every sample into one table */
+	freq_table = makeFreqTable();
+	if (!freq_table) {
+		perror("malloc FrequencyTable");
+		exit(EXIT_FAILURE);
+	}
+	for (i = optind + 1; i < argc; i++) {
+		countSample(argv[i], freq_table);
+	}
+	if (freq_table->count == 0) {
+		fprintf(stderr, "%s: the samples are empty\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	sample_bytes = freq_table->count;
+	trainDict(freq_table, max_len, &dict);
+	for (i = 0; i < MAX_NUM_BYTES; i++) {
+		bits += (double)freq_table->freq[i] * dict.lengths[i];
+	}
+
+	out_file = open(argv[optind], O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU);
+	if (out_file == -1) {
+		perror(argv[optind]);
+		exit(EXIT_FAILURE);
+	}
+	out = makeWriter(out_file, BUF_SIZE);
+	writeDict(out, &dict);
+	writerDestroy(out);
+	close(out_file);
+
+	fprintf(stderr, "table %08x: %llu sample bytes, %.3f bits per byte, "
+			"longest code %u\n", dict.id,
+			(unsigned long long)sample_bytes,
+			bits / sample_bytes, dict.max_len);
+	ftableDestroy(freq_table);
+	return 0;
+}
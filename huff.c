@@ -0,0 +1,413 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "freq.h"
+#include "bufio.h"
+#include "canon.h"
+#include "dtable.h"
+#include "filerw.h"
+#include "block.h"
+#include "huff.h"
+
+/* Creates a context for compressing and decompressing buffers. Returns
+ * NULL if it can't be allocated. */
+HuffContext *makeHuffContext(void) {
+	HuffContext *ctx = calloc(1, sizeof(HuffContext));
+	if (!ctx) {
+		return NULL;
+	}
+	ctx->freq_table.size = MAX_NUM_BYTES;
+	return ctx;
+}
+
+/* Frees a context and everything it kept between calls */
+void huffContextDestroy(HuffContext *ctx) {
+	if (!ctx) {
+		return;
+	}
+	if (ctx->table) {
+		dtableDestroy(ctx->table);
+	}
+	free(ctx->scratch);
+	free(ctx->dict);
+	free(ctx);
+}
+
+/* Gives a context a table written by htrain. Buffers are then coded
+ * with the table's codes, and their header only names the table, which
+ * saves a pass over the input and the code lengths in every buffer.
+ * Decompressing them needs a context with the same table. A table of
+ * NULL goes back to building codes for each buffer.
+ *
+ * Parameters:
+ *  ctx - A context from makeHuffContext
+ *  table - The contents of a table file
+ *  n - The number of bytes in table
+ *
+ * Returns HUFF_OK, or HUFF_ERR_FORMAT if table is not a valid table, or
+ * HUFF_ERR_NOMEM.
+ */
+int huffUseDict(HuffContext *ctx, const void *table, size_t n) {
+	BufReader in;
+
+	if (!table) {
+		free(ctx->dict);
+		ctx->dict = NULL;
+		return HUFF_OK;
+	}
+	if (!ctx->dict && !(ctx->dict = malloc(sizeof(Dictionary)))) {
+		return HUFF_ERR_NOMEM;
+	}
+	initMemReader(&in, table, n);
+	if (readDict(&in, ctx->dict) == -1) {
+		free(ctx->dict);
+		ctx->dict = NULL;
+		return HUFF_ERR_FORMAT;
+	}
+	return HUFF_OK;
+}
+
+/* Returns the most bytes huffCompress can produce for n bytes of input.
+ * No huffman code does worse than 8 bits per char., since 8 bit codes
+ * for every char. are a valid prefix code, so the body is never longer
+ * than the input. */
+size_t huffBound(size_t n) {
+	return HUFF_HEADER_MAX + n;
+}
+
+/* Sets up a writer for at most bound bytes of output. The output goes
+ * straight into dst when it is sure to fit, and into the context's
+ * scratch buffer otherwise. Returns -1 if scratch can't be grown. */
+static int initOutput(HuffContext *ctx, BufWriter *out, void *dst,
+		size_t cap, size_t bound) {
+	uint8_t *scratch;
+
+	out->fd = -1;
+	out->len = 0;
+	out->aio = NULL;
+	if (cap >= bound) {
+		out->buf = dst;
+		out->size = cap;
+		return 0;
+	}
+	if (ctx->scratch_size < bound) {
+		scratch = realloc(ctx->scratch, bound);
+		if (!scratch) {
+			return -1;
+		}
+		ctx->scratch = scratch;
+		ctx->scratch_size = bound;
+	}
+	out->buf = ctx->scratch;
+	out->size = ctx->scratch_size;
+	return 0;
+}
+
+/* Hands the output of a writer set up by initOutput to the caller */
+static int finishOutput(BufWriter *out, void *dst, size_t cap,
+		size_t *dst_len) {
+	if (out->buf != dst) {
+		if (out->len > cap) {
+			return HUFF_ERR_DSTSIZE;
+		}
+		memcpy(dst, out->buf, out->len);
+	}
+	*dst_len = out->len;
+	return HUFF_OK;
+}
+
+/* Compresses a buffer with the context's table. Returns 1 once it is
+ * done, 0 if the buffer is so unlike the table's samples that it would
+ * come out larger than huffBound allows, or an HUFF_ERR code. */
+static int compressDict(HuffContext *ctx, const uint8_t *src, size_t n,
+		void *dst, size_t cap, size_t *dst_len) {
+	Dictionary *dict = ctx->dict;
+	/* Header, then at most max_len bits per char. */
+	size_t bound = MAGIC_LEN + 1 + sizeof(uint32_t) + VARINT_MAX
+			+ (n / 8 + 1) * dict->max_len;
+	BufWriter out;
+	BitWriter bw;
+	int status;
+
+	if (initOutput(ctx, &out, dst, cap, bound) == -1) {
+		return HUFF_ERR_NOMEM;
+	}
+	makeDictHeader(&out, dict, n);
+	initBitWriter(&bw, &out);
+	encodeBytes(src, n, &bw, dict->codes);
+	flushBits(&bw);
+	if (out.len > huffBound(n)) {
+		return 0;
+	}
+	status = finishOutput(&out, dst, cap, dst_len);
+	return status == HUFF_OK ? 1 : status;
+}
+
+/* Empties the context's frequency table for the next buffer */
+static void resetTable(FrequencyTable *freq_table) {
+	memset(freq_table, 0, sizeof(FrequencyTable));
+	freq_table->size = MAX_NUM_BYTES;
+}
+
+/* Compresses a buffer into another. The output is the same as what
+ * hencode writes for a file holding the buffer, so either side of a
+ * transfer can be a file. An empty input compresses to nothing. With a table from huffUseDict,
+ * the table's codes are used unless the buffer would come out larger
+ * than huffBound(n) with them.
+ *
+ * Parameters:
+ *  ctx - A context from makeHuffContext
+ *  src - The bytes to compress
+ *  n - The number of bytes in src
+ *  dst - Where the compressed bytes go
+ *  cap - The number of bytes dst can hold. Compression goes straight
+ *        into dst when cap is at least huffBound(n).
+ *  dst_len - Set to the number of compressed bytes
+ *
+ * Returns HUFF_OK, or HUFF_ERR_DSTSIZE if the output does not fit in
+ * cap bytes, or another HUFF_ERR code.
+ */
+int huffCompress(HuffContext *ctx, const void *src, size_t n, void *dst,
+		size_t cap, size_t *dst_len) {
+	/* A writer over a buffer that is known to be large enough, so it
+	 * never has to flush */
+	BufWriter out;
+	BitWriter bw;
+	int status;
+
+	*dst_len = 0;
+	if (n == 0) {
+		return HUFF_OK;
+	}
+	if (ctx->dict) {
+		status = compressDict(ctx, src, n, dst, cap, dst_len);
+		if (status != 0) {
+			return status > 0 ? HUFF_OK : status;
+		}
+	}
+	resetTable(&ctx->freq_table);
+	countFreq(src, n, &ctx->freq_table);
+	makeCodes(&ctx->freq_table, ctx->max_len);
+	chooseMode(&ctx->freq_table);
+
+	if (initOutput(ctx, &out, dst, cap, huffBound(n)) == -1) {
+		return HUFF_ERR_NOMEM;
+	}
+	makeHeader(&out, &ctx->freq_table);
+	if (ctx->freq_table.stored) {
+		writerWrite(&out, src, n);
+	}
+	else {
+		initBitWriter(&bw, &out);
+		encodeBytes(src, n, &bw, ctx->freq_table.codes);
+		flushBits(&bw);
+	}
+	return finishOutput(&out, dst, cap, dst_len);
+}
+
+/* Decompresses a buffer written by huffCompress, or a file written by
+ * hencode without blocks or adaptive codes. A buffer written with a
+ * table needs the same table set by huffUseDict.
+ *
+ * Parameters:
+ *  ctx - A context from makeHuffContext
+ *  src - The compressed bytes
+ *  n - The number of bytes in src
+ *  dst - Where the decompressed bytes go
+ *  cap - The number of bytes dst can hold
+ *  dst_len - Set to the number of decompressed bytes. When the output
+ *            does not fit, it is set to the size needed.
+ *
+ * Returns HUFF_OK, or HUFF_ERR_DSTSIZE if the output does not fit in
+ * cap bytes, or HUFF_ERR_CORRUPT if the body is cut short, or another
+ * HUFF_ERR code.
+ */
+int huffDecompress(HuffContext *ctx, const void *src, size_t n, void *dst,
+		size_t cap, size_t *dst_len) {
+	const uint8_t *bytes = src;
+	FrequencyTable *freq_table = &ctx->freq_table;
+	BufReader in;
+	BufWriter out;
+	int c = 0;
+	int version, status;
+
+	*dst_len = 0;
+	if (n == 0) {
+		return HUFF_OK;
+	}
+	if (n < MAGIC_LEN + 1 || memcmp(bytes, HUFF_MAGIC, MAGIC_LEN) != 0) {
+		return HUFF_ERR_FORMAT;
+	}
+	version = bytes[MAGIC_LEN];
+	initMemReader(&in, bytes + MAGIC_LEN + 1, n - MAGIC_LEN - 1);
+	resetTable(freq_table);
+	if (version == VERSION_CANON) {
+		status = readLengths(&in, freq_table);
+	}
+	else if (version == VERSION_WIDE) {
+		status = readWideLengths(&in, freq_table);
+	}
+	else if (version == VERSION_DICT) {
+		if (!ctx->dict) {
+			return HUFF_ERR_DICT;
+		}
+		status = readDictHeader(&in, ctx->dict, freq_table);
+		if (status == DICT_MISMATCH) {
+			return HUFF_ERR_DICT;
+		}
+	}
+	else {
+		return HUFF_ERR_FORMAT;
+	}
+	if (status == -1) {
+		return HUFF_ERR_CORRUPT;
+	}
+	*dst_len = freq_table->count;
+	if (freq_table->count > cap) {
+		return HUFF_ERR_DSTSIZE;
+	}
+	/* Stored body, copied as it is */
+	if (freq_table->stored) {
+		if (in.len - in.pos < freq_table->count) {
+			return HUFF_ERR_CORRUPT;
+		}
+		memcpy(dst, in.buf + in.pos, freq_table->count);
+		return HUFF_OK;
+	}
+	/* Single repeated char., there is no body */
+	if (freq_table->unique_count == 1) {
+		while (freq_table->freq[c] == 0) {
+			c++;
+		}
+		memset(dst, c, freq_table->count);
+		return HUFF_OK;
+	}
+	if (!ctx->table) {
+		ctx->table = makeCanonTable(freq_table->lengths);
+		if (!ctx->table) {
+			return HUFF_ERR_NOMEM;
+		}
+	}
+	else if (loadCanonTable(ctx->table, freq_table->lengths) == -1) {
+		return HUFF_ERR_NOMEM;
+	}
+	/* Exactly count bytes are written, which fit */
+	out.fd = -1;
+	out.aio = NULL;
+	out.buf = dst;
+	out.size = cap;
+	out.len = 0;
+	if (decode(&in, &out, ctx->table, freq_table) == -1) {
+		return HUFF_ERR_CORRUPT;
+	}
+	return HUFF_OK;
+}
+
+/* Decompresses part of a blocked file (hencode -T, -B or -I) held in
+ * memory, decoding only the blocks that hold the range. A range that
+ * runs past the end of the data is cut short there. The blocks are
+ * decoded with the context's tables and into its scratch buffer, which
+ * are kept for the next call.
+ *
+ * Parameters:
+ *  ctx - A context from makeHuffContext
+ *  src - The whole compressed file
+ *  n - The number of bytes in src
+ *  offset - Offset in the decompressed data of the first byte wanted
+ *  length - Number of bytes wanted
+ *  dst - Where the decompressed bytes go
+ *  cap - The number of bytes dst can hold
+ *  dst_len - Set to the number of decompressed bytes. When the range,
+ *            once cut short at the end of the data, does not fit, it is
+ *            set to the size needed.
+ *
+ * Returns HUFF_OK, or HUFF_ERR_RANGE if offset is past the end of the
+ * data, or HUFF_ERR_DSTSIZE if the range does not fit in cap bytes, or
+ * another HUFF_ERR code.
+ */
+int huffDecompressRange(HuffContext *ctx, const void *src, size_t n, 
+		uint64_t offset, uint64_t length, void *dst, size_t cap, 
+		size_t *dst_len) {
+	const uint8_t *bytes = src;
+	BlockIndex *index;
+	BlockDecoder dec;
+	BufWriter block;
+	BufWriter out;
+	uint64_t end;
+	int64_t status;
+
+	*dst_len = 0;
+	if (n < MAGIC_LEN + 1 || memcmp(bytes, HUFF_MAGIC, MAGIC_LEN) != 0
+		|| (bytes[MAGIC_LEN] != VERSION_BLOCKED 
+			&& bytes[MAGIC_LEN] != VERSION_INTERLEAVED)) {
+		return HUFF_ERR_FORMAT;
+	}
+	status = readIndex(bytes, n, &index);
+	if (status == BLOCK_NOMEM) {
+		return HUFF_ERR_NOMEM;
+	}
+	if (status == -1) {
+		return HUFF_ERR_CORRUPT;
+	}
+	if (offset > index->total) {
+		indexDestroy(index);
+		return HUFF_ERR_RANGE;
+	}
+	end = length > index->total - offset ? index->total : offset + length;
+	if (end - offset > cap) {
+		*dst_len = end - offset;
+		indexDestroy(index);
+		return HUFF_ERR_DSTSIZE;
+	}
+
+	dec.freq_table = &ctx->freq_table;
+	dec.table = ctx->table;
+	block.fd = -1;
+	block.aio = NULL;
+	block.buf = ctx->scratch;
+	block.size = ctx->scratch_size;
+	block.len = 0;
+	/* At most cap bytes are written, which fit */
+	out.fd = -1;
+	out.aio = NULL;
+	out.buf = dst;
+	out.size = cap;
+	out.len = 0;
+	status = decodeRange(bytes, index, offset, end, &dec, &block, &out);
+	ctx->table = dec.table;
+	ctx->scratch = block.buf;
+	ctx->scratch_size = block.size;
+	indexDestroy(index);
+	if (status == BLOCK_NOMEM) {
+		return HUFF_ERR_NOMEM;
+	}
+	if (status == -1) {
+		return HUFF_ERR_CORRUPT;
+	}
+	*dst_len = status;
+	return HUFF_OK;
+}
+
+/* Returns a description of a return code */
+const char *huffError(int code) {
+	switch (code) {
+		case HUFF_OK:
+			return "success";
+		case HUFF_STREAM_END:
+			return "end of stream";
+		case HUFF_ERR_NOMEM:
+			return "out of memory";
+		case HUFF_ERR_DSTSIZE:
+			return "output buffer too small";
+		case HUFF_ERR_FORMAT:
+			return "not a compressed buffer";
+		case HUFF_ERR_CORRUPT:
+			return "truncated or invalid header";
+		case HUFF_ERR_RANGE:
+			return "range starts past the end";
+		case HUFF_ERR_DICT:
+			return "written with a table the context does not have";
+	}
+	return "unknown error";
+}
@@ -0,0 +1,64 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifndef HUFFH
+#define HUFFH
+#include "freq.h"
+#include "dtable.h"
+#include "filerw.h"
+#include "dict.h"
+
+/* Return codes of the library calls. Errors are negative. */
+#define HUFF_OK 0
+/* A stream has written out the whole of its buffer */
+#define HUFF_STREAM_END 1
+/* Out of memory */
+#define HUFF_ERR_NOMEM -1
+/* The output buffer is too small */
+#define HUFF_ERR_DSTSIZE -2
+/* The input is not a compressed buffer this library can read */
+#define HUFF_ERR_FORMAT -3
+/* The compressed buffer is cut short or its code lengths are invalid */
+#define HUFF_ERR_CORRUPT -4
+/* The range starts past the end of the decompressed data */
+#define HUFF_ERR_RANGE -5
+/* The buffer was written with a table the context does not have */
+#define HUFF_ERR_DICT -6
+
+/* Most bytes of a compressed buffer that are not body: the magic bytes,
+ * version, count, max_len, lo, hi and a length byte per char. */
+#define HUFF_HEADER_MAX (MAGIC_LEN + 1 + VARINT_MAX + 3 + MAX_NUM_BYTES)
+
+/* HuffContext: Everything a compress or decompress call needs, kept
+ * between calls so that a context used for many small buffers does not
+ * allocate once it has warmed up. A context must not be used by two
+ * threads at once. */
+typedef struct HuffContext {
+	/* Frequencies, lengths and codes of the current buffer */
+	FrequencyTable freq_table;
+	/* Decode table, rebuilt in place for every buffer. NULL until the
+	 * first buffer that needs one. */
+	DecodeTable *table;
+	/* Output is built here when the caller's buffer might be too small
+	 * for the worst case */
+	uint8_t *scratch;
+	/* Capacity of scratch */
+	size_t scratch_size;
+	/* Longest code allowed, 0 for no limit. See hencode -L. */
+	int max_len;
+	/* Table set by huffUseDict, NULL for codes built per buffer */
+	Dictionary *dict;
+} HuffContext;
+
+HuffContext *makeHuffContext(void);
+void huffContextDestroy(HuffContext *);
+int huffUseDict(HuffContext *, const void *, size_t);
+size_t huffBound(size_t);
+int huffCompress(HuffContext *, const void *, size_t, void *, size_t,
+		size_t *);
+int huffDecompress(HuffContext *, const void *, size_t, void *, size_t,
+		size_t *);
+int huffDecompressRange(HuffContext *, const void *, size_t, uint64_t, 
+		uint64_t, void *, size_t, size_t *);
+const char *huffError(int);
+#endif
@@ -6,7 +6,7 @@
 #include "llist.h"
 
 /* Creates a node */
-Node *createNode(int ascii, int freq) {
+Node *createNode(int ascii, uint64_t freq) {
 	Node *node = (Node *)malloc(sizeof(Node));
 	if (!node) {
 		perror("malloc");
@@ -168,10 +168,12 @@ void printList(LinkedList *llst) {
 	Node *temp = llst -> head;
 	while (temp != NULL) {
 		if (temp ->next == NULL) {
-			printf("(%c)%d <-> NULL\n", temp->ascii, temp->freq);
+			printf("(%c)%llu <-> NULL\n", temp->ascii,
+				(unsigned long long)temp->freq);
 			}
 		else {
-			printf ("(%c)%d <-> ", temp->ascii, temp->freq);
+			printf ("(%c)%llu <-> ", temp->ascii,
+				(unsigned long long)temp->freq);
 		}
 		temp = temp ->next;
 	}
@@ -180,7 +182,7 @@ void printList(LinkedList *llst) {
 /* Combines two nodes into one */
 Node *buildTree(LinkedList *llst) {
 	Node *combined, *left, *right;
-	int freqSum;
+	uint64_t freqSum;
 	while (llst->size != 1) {
 		left = removeNode(llst);
 		right = removeNode(llst);
@@ -196,33 +198,19 @@ Node *buildTree(LinkedList *llst) {
 	return llst->head;
 }
 
-/* Generates codes of each character on the tree into the array of 
- * char pointers in the frequency table. Takes in an empty string 
- * initially. */
-char **genCodes(Node *tree, char **codes, char *build_code) {
-	/* Every time temp code is to be built, increase its size by 2
-	 * because you need +1 for either another 0 or 1 and +1 for the
-	 * null character. */
-	char *final_code;
-	char temp_code[strlen(build_code) + 2];
-	strcpy(temp_code, build_code);
-
-	/* Go left until node has no left node */
-	if (tree->left) {
-		sprintf(temp_code, "%s0", build_code); 
-		genCodes(tree->left, codes, temp_code);
-	}
-	/* Go right until node has no right node */
-	if (tree->right) {
-		sprintf(temp_code, "%s1", build_code); 
-		genCodes(tree->right, codes, temp_code);
-	}
-	/* Leaf node encountered, copy temp code into codes using strdup
-	 * instead of strcpy because strdup mallocs */
+/* Generates codes of each character on the tree into the code table
+ * in the frequency table. Each code is built up as an integer, one bit
+ * per level of the tree. Takes in 0 bits and a depth of 0 initially. */
+Code *genCodes(Node *tree, Code *codes, uint64_t bits, unsigned int depth) {
+	/* Leaf node encountered, the bits so far are its code */
 	if (!(tree->left && tree->right)) {
-		final_code = strdup(temp_code);
-		codes[tree->ascii] = final_code;
+		codes[tree->ascii].bits = bits;
+		codes[tree->ascii].len = depth;
+		return codes;
 	}
+	/* Going left adds a 0 and going right adds a 1 */
+	genCodes(tree->left, codes, bits << 1, depth + 1);
+	genCodes(tree->right, codes, (bits << 1) | 1, depth + 1);
 	return codes;
 }
 
@@ -10,7 +10,7 @@ struct Node {
 	/* ASCII value that the node represents. */
 	unsigned int ascii;
 	/* Frequency of a character represented by the node */
-	int freq;
+	uint64_t freq;
 	/* Pointer to the next node in the linked list */
 	Node *next;
 	/* Pointer to the previous node in the linked list */
@@ -28,14 +28,14 @@ struct LinkedList {
 	unsigned int size;
 };
 
-Node *createNode(int, int);
+Node *createNode(int, uint64_t);
 LinkedList *createList(FrequencyTable *);
 void lstInsert(LinkedList *, Node *);
 void huffLstInsert(LinkedList *, Node *);
 Node *removeNode(LinkedList *);
 void printList(LinkedList *);
 Node *buildTree(LinkedList *);
-char **genCodes(Node *, char **, char *);
+Code *genCodes(Node *, Code *, uint64_t, unsigned int);
 void treeDestroy(Node *);
 #endif
 
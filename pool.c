@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "pool.h"
+
+/* Returns the number of threads to use for a requested count. A count
+ * of 0 or less means one per online CPU. */
+int poolThreads(int requested) {
+	long cpus;
+	if (requested > 0) {
+		return requested;
+	}
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return cpus > 0 ? (int)cpus : 1;
+}
+
+/* Takes tasks off the queue and runs them until the pool stops */
+static void *worker(void *arg) {
+	ThreadPool *pool = arg;
+	Task *task;
+
+	pthread_mutex_lock(&pool->lock);
+	while (1) {
+		while (!pool->head && !pool->stop) {
+			pthread_cond_wait(&pool->queued, &pool->lock);
+		}
+		if (!pool->head) {
+			break;
+		}
+		task = pool->head;
+		pool->head = task->next;
+		if (!pool->head) {
+			pool->tail = NULL;
+		}
+		pthread_mutex_unlock(&pool->lock);
+
+		task->fn(task->arg);
+
+		pthread_mutex_lock(&pool->lock);
+		task->done = 1;
+		pthread_cond_broadcast(&pool->finished);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+/* Creates a pool of nthreads workers */
+ThreadPool *makePool(int nthreads) {
+	int i;
+	ThreadPool *pool = malloc(sizeof(ThreadPool));
+	if (!pool) {
+		perror("malloc ThreadPool");
+		exit(EXIT_FAILURE);
+	}
+	pool->nthreads = nthreads > 1 ? nthreads : 0;
+	pool->head = NULL;
+	pool->tail = NULL;
+	pool->stop = 0;
+	pool->threads = NULL;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->queued, NULL);
+	pthread_cond_init(&pool->finished, NULL);
+	if (pool->nthreads == 0) {
+		return pool;
+	}
+	pool->threads = malloc(pool->nthreads * sizeof(pthread_t));
+	if (!pool->threads) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < pool->nthreads; i++) {
+		if (pthread_create(&pool->threads[i], NULL, worker, pool)) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+	return pool;
+}
+
+/* Queues a task. With no worker threads it runs right away. */
+void poolSubmit(ThreadPool *pool, Task *task) {
+	task->done = 0;
+	task->next = NULL;
+	if (pool->nthreads == 0) {
+		task->fn(task->arg);
+		task->done = 1;
+		return;
+	}
+	pthread_mutex_lock(&pool->lock);
+	if (pool->tail) {
+		pool->tail->next = task;
+	}
+	else {
+		pool->head = task;
+	}
+	pool->tail = task;
+	pthread_cond_signal(&pool->queued);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/* Blocks until a submitted task has finished */
+void poolWaitTask(ThreadPool *pool, Task *task) {
+	pthread_mutex_lock(&pool->lock);
+	while (!task->done) {
+		pthread_cond_wait(&pool->finished, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/* Waits for the workers to drain the queue, then frees the pool */
+void poolDestroy(ThreadPool *pool) {
+	int i;
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->queued);
+	pthread_mutex_unlock(&pool->lock);
+	for (i = 0; i < pool->nthreads; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->queued);
+	pthread_cond_destroy(&pool->finished);
+	free(pool->threads);
+	free(pool);
+}
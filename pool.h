@@ -0,0 +1,49 @@
+#include <stdlib.h>
+#include <pthread.h>
+
+#ifndef POOLH
+#define POOLH
+
+typedef struct Task Task;
+typedef struct ThreadPool ThreadPool;
+
+/* Task: A unit of work handed to the pool. Tasks are owned by the caller
+ * and linked into the pool's queue without any allocation. */
+struct Task {
+	/* Function run by a worker */
+	void (*fn)(void *);
+	/* Argument passed to fn */
+	void *arg;
+	/* Set by the pool once fn has returned */
+	int done;
+	/* Next task in the queue */
+	Task *next;
+};
+
+/* ThreadPool: A fixed set of worker threads pulling tasks off a queue
+ * in the order they were submitted */
+struct ThreadPool {
+	/* Worker threads. There are none when the pool has one thread;
+	 * tasks are then run by the caller as they are submitted. */
+	pthread_t *threads;
+	/* Number of worker threads */
+	int nthreads;
+	/* Queue of tasks waiting for a worker */
+	Task *head;
+	Task *tail;
+	/* Set when the pool is being destroyed */
+	int stop;
+	/* Protects everything above and each task's done flag */
+	pthread_mutex_t lock;
+	/* Signalled when a task is queued or the pool is stopping */
+	pthread_cond_t queued;
+	/* Signalled when a task finishes */
+	pthread_cond_t finished;
+};
+
+int poolThreads(int);
+ThreadPool *makePool(int);
+void poolSubmit(ThreadPool *, Task *);
+void poolWaitTask(ThreadPool *, Task *);
+void poolDestroy(ThreadPool *);
+#endif
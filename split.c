@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <endian.h>
+#include "freq.h"
+#include "bufio.h"
+#include "filerw.h"
+#include "pool.h"
+#include "split.h"
+
+/* Creates a job that splits n bytes of memory into chunks for threads
+ * threads. Inputs too small to split are a single chunk.
+ *
+ * Parameters:
+ *  src - The input, which must stay in memory until the job is done
+ *  n - The number of bytes in src, which must be greater than 0
+ *  threads - The number of threads counting and encoding chunks
+ */
+SplitJob *makeSplitJob(const uint8_t *src, uint64_t n, int threads) {
+	SplitJob *job = malloc(sizeof(SplitJob));
+	uint64_t per, start;
+	int i;
+
+	if (!job) {
+		perror("malloc SplitJob");
+		exit(EXIT_FAILURE);
+	}
+	job->src = src;
+	job->n = n;
+	job->nchunks = threads * SPLIT_CHUNKS_PER_THREAD;
+	if ((uint64_t)job->nchunks > n / SPLIT_MIN_CHUNK) {
+		job->nchunks = n / SPLIT_MIN_CHUNK;
+	}
+	if (job->nchunks < 1) {
+		job->nchunks = 1;
+	}
+	job->chunks = calloc(job->nchunks, sizeof(SplitChunk));
+	if (!job->chunks) {
+		perror("malloc SplitChunk");
+		exit(EXIT_FAILURE);
+	}
+	per = n / job->nchunks;
+	start = 0;
+	for (i = 0; i < job->nchunks; i++) {
+		job->chunks[i].src = src + start;
+		job->chunks[i].n = i == job->nchunks - 1 ? n - start : per;
+		job->chunks[i].counts = makeFreqTable();
+		if (!job->chunks[i].counts) {
+			perror("malloc FrequencyTable");
+			exit(EXIT_FAILURE);
+		}
+		job->chunks[i].task.arg = &job->chunks[i];
+		start += per;
+	}
+	job->pool = makePool(threads < job->nchunks ? threads : job->nchunks);
+	return job;
+}
+
+/* Task function counting the chars. of one chunk */
+static void countChunk(void *arg) {
+	SplitChunk *chunk = arg;
+	countFreq(chunk->src, chunk->n, chunk->counts);
+}
+
+/* Puts the frequencies of the job's input into a freq table. Each chunk
+ * is counted on its own and its counts are kept, so that once the codes
+ * are known the size of every chunk's codes is found without reading
+ * the input again. */
+void splitCount(SplitJob *job, FrequencyTable *freq_table) {
+	int i, c;
+	for (i = 0; i < job->nchunks; i++) {
+		job->chunks[i].task.fn = countChunk;
+		poolSubmit(job->pool, &job->chunks[i].task);
+	}
+	for (i = 0; i < job->nchunks; i++) {
+		poolWaitTask(job->pool, &job->chunks[i].task);
+		for (c = 0; c < MAX_NUM_BYTES; c++) {
+			freq_table->freq[c] += job->chunks[i].counts->freq[c];
+		}
+	}
+	freq_table->count += job->n;
+	freq_table->unique_count = 0;
+	for (c = 0; c < MAX_NUM_BYTES; c++) {
+		freq_table->unique_count += freq_table->freq[c] != 0;
+	}
+}
+
+/* Task function encoding one chunk straight into its place in the
+ * body. The bit writer starts with as many zero bits as the chunk's
+ * first code is into its byte, so its words line up with the body's
+ * bytes. That first byte is written by this chunk, with zeros where the
+ * previous chunk's bits go; the last partial byte is kept in tail. */
+static void encodeChunk(void *arg) {
+	SplitChunk *chunk = arg;
+	/* A writer over exactly the whole bytes the chunk fills, so it
+	 * never has to flush */
+	BufWriter out;
+	BitWriter bw;
+	uint64_t word;
+	int whole;
+
+	out.fd = -1;
+	out.aio = NULL;
+	out.buf = chunk->body + chunk->offset / 8;
+	out.size = (chunk->offset + chunk->bits) / 8 - chunk->offset / 8;
+	out.len = 0;
+	initBitWriter(&bw, &out);
+	bw.nbits = chunk->offset % 8;
+	encodeBytes(chunk->src, chunk->n, &bw, chunk->codes);
+
+	chunk->tail = 0;
+	if (bw.nbits > 0) {
+		word = htobe64(bw.acc << (64 - bw.nbits));
+		whole = bw.nbits / 8;
+		writerWrite(&out, &word, whole);
+		chunk->tail = ((uint8_t *)&word)[whole];
+	}
+}
+
+/* Writes the body of the job's input through a writer, encoded by the
+ * job's threads at once. The size of each chunk's codes is summed from
+ * its counts and the code lengths, which gives every chunk the bit
+ * offset its codes start at. The body is then mapped into the output
+ * file at its final size, or built in memory when the output is not a
+ * file that can be mapped, and each chunk is encoded into its place.
+ * Stored bodies and runs are written as makeBody writes them.
+ *
+ * Parameters:
+ *  job - A job whose input has been counted by splitCount
+ *  freq_table - The job's freq table, with its codes and mode set
+ *  out - The writer the body goes to, just past the header
+ *
+ * Returns 0 if the body had to be built in memory, 1 otherwise.
+ */
+int splitEncode(SplitJob *job, FrequencyTable *freq_table,
+		BufWriter *out) {
+	SplitChunk *chunk;
+	BufReader in;
+	uint64_t bits = 0;
+	size_t size;
+	uint8_t *body;
+	int mapped = 1;
+	int i, c;
+
+	if (freq_table->stored || freq_table->unique_count == 1) {
+		initMemReader(&in, job->src, job->n);
+		makeBody(&in, job->n, out, freq_table);
+		return 1;
+	}
+	for (i = 0; i < job->nchunks; i++) {
+		chunk = &job->chunks[i];
+		chunk->codes = freq_table->codes;
+		chunk->offset = bits;
+		chunk->bits = 0;
+		for (c = 0; c < MAX_NUM_BYTES; c++) {
+			chunk->bits += chunk->counts->freq[c] *
+					freq_table->codes[c].len;
+		}
+		bits += chunk->bits;
+	}
+	size = (bits + 7) / 8;
+
+	body = mapOutput(out, size);
+	if (!body) {
+		body = malloc(size);
+		if (!body) {
+			perror("malloc");
+			exit(EXIT_FAILURE);
+		}
+		mapped = 0;
+	}
+	for (i = 0; i < job->nchunks; i++) {
+		job->chunks[i].body = body;
+		job->chunks[i].task.fn = encodeChunk;
+		poolSubmit(job->pool, &job->chunks[i].task);
+	}
+	for (i = 0; i < job->nchunks; i++) {
+		poolWaitTask(job->pool, &job->chunks[i].task);
+	}
+	/* Merge the partial bytes. The next chunk has already written each
+	 * one with zeros in place of these bits. Chunks are at least 8
+	 * chars. long, so every chunk fills at least one byte; only the
+	 * last byte of the body is written by nobody else. */
+	for (i = 0; i < job->nchunks; i++) {
+		chunk = &job->chunks[i];
+		if ((chunk->offset + chunk->bits) % 8 == 0) {
+			continue;
+		}
+		if (i == job->nchunks - 1) {
+			body[size - 1] = chunk->tail;
+		}
+		else {
+			body[(chunk->offset + chunk->bits) / 8] |= chunk->tail;
+		}
+	}
+
+	if (mapped) {
+		unmapOutput(out, body, size);
+	}
+	else {
+		writerWrite(out, body, size);
+		free(body);
+	}
+	return mapped;
+}
+
+/* Frees the job and stops its threads. The input is left alone. */
+void splitJobDestroy(SplitJob *job) {
+	int i;
+	poolDestroy(job->pool);
+	for (i = 0; i < job->nchunks; i++) {
+		ftableDestroy(job->chunks[i].counts);
+	}
+	free(job->chunks);
+	free(job);
+}
@@ -0,0 +1,51 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifndef SPLITH
+#define SPLITH
+#include "freq.h"
+#include "bufio.h"
+#include "pool.h"
+
+/* Chunks each thread's share of the input is cut into, so that a thread
+ * that falls behind holds up the others less */
+#define SPLIT_CHUNKS_PER_THREAD 4
+/* Fewest input bytes in a chunk */
+#define SPLIT_MIN_CHUNK (1 << 20)
+
+/* SplitChunk: A range of the input that one task counts and encodes,
+ * and where its codes go in the body */
+typedef struct SplitChunk {
+	Task task;
+	/* The chunk's bytes */
+	const uint8_t *src;
+	size_t n;
+	/* Counts of the chunk's chars. */
+	FrequencyTable *counts;
+	/* Codes of the whole input */
+	const Code *codes;
+	/* Bit offset of the chunk's first code in the body */
+	uint64_t offset;
+	/* Number of bits the chunk's codes take */
+	uint64_t bits;
+	/* The body, which the chunk's whole bytes are written into */
+	uint8_t *body;
+	/* The chunk's last partial byte, merged into the body once every
+	 * chunk is done since the next chunk starts in the same byte */
+	uint8_t tail;
+} SplitChunk;
+
+/* SplitJob: One input encoded as a single body by several threads */
+typedef struct SplitJob {
+	const uint8_t *src;
+	uint64_t n;
+	SplitChunk *chunks;
+	int nchunks;
+	ThreadPool *pool;
+} SplitJob;
+
+SplitJob *makeSplitJob(const uint8_t *, uint64_t, int);
+void splitCount(SplitJob *, FrequencyTable *);
+int splitEncode(SplitJob *, FrequencyTable *, BufWriter *);
+void splitJobDestroy(SplitJob *);
+#endif
@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "freq.h"
+#include "bufio.h"
+#include "stats.h"
+
+/* Returns the time in seconds on the given clock */
+static double clockSeconds(clockid_t clock) {
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Creates the stats for a run of a program */
+Stats *makeStats(const char *program) {
+	Stats *stats = calloc(1, sizeof(Stats));
+	if (!stats) {
+		perror("malloc Stats");
+		exit(EXIT_FAILURE);
+	}
+	stats->program = program;
+	stats->mode = "none";
+	stats->bits_per_symbol = -1;
+	stats->entropy = -1;
+	return stats;
+}
+
+/* Records the file format the run used */
+void statsMode(Stats *stats, const char *mode) {
+	if (!stats) {
+		return;
+	}
+	stats->mode = mode;
+}
+
+/* Ends the phase being timed, if any, and starts timing a new one. A
+ * name of NULL only ends the running phase. CPU time is for the whole
+ * process, so it includes every worker thread. */
+void statsPhase(Stats *stats, const char *name) {
+	double wall, cpu;
+	Phase *phase;
+
+	if (!stats) {
+		return;
+	}
+	wall = clockSeconds(CLOCK_MONOTONIC);
+	cpu = clockSeconds(CLOCK_PROCESS_CPUTIME_ID);
+	if (stats->running) {
+		phase = &stats->phases[stats->nphases - 1];
+		phase->wall = wall - stats->wall_start;
+		phase->cpu = cpu - stats->cpu_start;
+		stats->running = 0;
+	}
+	if (name && stats->nphases < MAX_PHASES) {
+		phase = &stats->phases[stats->nphases++];
+		phase->name = name;
+		stats->wall_start = wall;
+		stats->cpu_start = cpu;
+		stats->running = 1;
+	}
+}
+
+/* Records the code of a run. The longest code comes from the code
+ * lengths, or from the codes when only those were filled in. The average
+ * code length and the entropy need the char. frequencies, so they are
+ * only known when the frequency table holds them. */
+void statsCodes(Stats *stats, FrequencyTable *freq_table) {
+	int c;
+	unsigned int len;
+	double p, bits = 0, entropy = 0;
+	uint64_t total = 0;
+
+	if (!stats) {
+		return;
+	}
+	stats->symbols = freq_table->count;
+	stats->max_len = 0;
+	for (c = 0; c < MAX_NUM_BYTES; c++) {
+		len = freq_table->lengths[c];
+		if (freq_table->codes[c].len > len) {
+			len = freq_table->codes[c].len;
+		}
+		if (len > stats->max_len) {
+			stats->max_len = len;
+		}
+		total += freq_table->freq[c];
+		bits += (double)freq_table->freq[c] * len;
+	}
+	if (total == 0) {
+		return;
+	}
+	for (c = 0; c < MAX_NUM_BYTES; c++) {
+		if (freq_table->freq[c] > 0) {
+			p = (double)freq_table->freq[c] / total;
+			entropy -= p * log2(p);
+		}
+	}
+	stats->bits_per_symbol = bits / total;
+	stats->entropy = entropy;
+}
+
+/* Prints the stats as a single JSON object, followed by a newline */
+void statsPrint(Stats *stats, FILE *f) {
+	struct rusage usage;
+	int i;
+
+	if (!stats) {
+		return;
+	}
+	statsPhase(stats, NULL);
+	getrusage(RUSAGE_SELF, &usage);
+	fprintf(f, "{\"program\":\"%s\",\"mode\":\"%s\",\"phases\":[",
+		stats->program, stats->mode);
+	for (i = 0; i < stats->nphases; i++) {
+		fprintf(f, "%s{\"name\":\"%s\",\"wall_s\":%.6f,"
+			"\"cpu_s\":%.6f}", i ? "," : "",
+			stats->phases[i].name, stats->phases[i].wall,
+			stats->phases[i].cpu);
+	}
+	fprintf(f, "],\"bytes_read\":%llu,\"bytes_mapped\":%llu,"
+		"\"bytes_written\":%llu,\"read_calls\":%llu,"
+		"\"write_calls\":%llu,\"map_calls\":%llu,"
+		"\"peak_rss_kb\":%ld",
+		(unsigned long long)io_counters.bytes_read,
+		(unsigned long long)io_counters.bytes_mapped,
+		(unsigned long long)io_counters.bytes_written,
+		(unsigned long long)io_counters.read_calls,
+		(unsigned long long)io_counters.write_calls,
+		(unsigned long long)io_counters.map_calls,
+		usage.ru_maxrss);
+	if (stats->symbols > 0) {
+		fprintf(f, ",\"symbols\":%llu,\"max_code_len\":%u",
+			(unsigned long long)stats->symbols, stats->max_len);
+	}
+	if (stats->entropy >= 0) {
+		fprintf(f, ",\"bits_per_symbol\":%.4f,\"entropy\":%.4f",
+			stats->bits_per_symbol, stats->entropy);
+	}
+	fprintf(f, "}\n");
+}
+
+/* Frees the stats */
+void statsDestroy(Stats *stats) {
+	free(stats);
+}
@@ -0,0 +1,48 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifndef STATSH
+#define STATSH
+#include "freq.h"
+
+/* Most phases a run can time */
+#define MAX_PHASES 8
+
+/* Phase: Wall clock and CPU time spent in one phase of a run */
+typedef struct Phase {
+	const char *name;
+	double wall;
+	double cpu;
+} Phase;
+
+/* Stats: What --stats reports about a run. Every stats call does
+ * nothing when given NULL, so the programs call them unconditionally. */
+typedef struct Stats {
+	/* Program and file format, for telling reports apart */
+	const char *program;
+	const char *mode;
+	Phase phases[MAX_PHASES];
+	int nphases;
+	/* Set while a phase is being timed */
+	int running;
+	/* When the running phase started */
+	double wall_start;
+	double cpu_start;
+	/* Chars. coded, 0 until statsCodes is called */
+	uint64_t symbols;
+	/* Longest code */
+	unsigned int max_len;
+	/* Average code length and Shannon entropy in bits per char., -1
+	 * when the frequencies aren't known */
+	double bits_per_symbol;
+	double entropy;
+} Stats;
+
+Stats *makeStats(const char *);
+void statsMode(Stats *, const char *);
+void statsPhase(Stats *, const char *);
+void statsCodes(Stats *, FrequencyTable *);
+void statsPrint(Stats *, FILE *);
+void statsDestroy(Stats *);
+#endif
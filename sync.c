@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "bufio.h"
+#include "dtable.h"
+#include "pool.h"
+#include "sync.h"
+
+/* Number of bits in a byte */
+#define BYTE_SIZE 8
+
+/* Creates a job that cuts a single huffman coded body into chunks for
+ * threads threads, with a window of SYNC_CHUNKS_PER_THREAD chunks per
+ * thread. Bodies too small to cut are a single chunk.
+ *
+ * Parameters:
+ *  body - The body, which must stay in memory until the job is done
+ *  size - The number of bytes in body, which must be greater than 0
+ *  table - A decode table built from the code lengths
+ *  count - The number of chars. the body decodes to
+ *  threads - The number of threads decoding chunks
+ */
+SyncJob *makeSyncJob(const uint8_t *body, size_t size,
+		const DecodeTable *table, uint64_t count, int threads) {
+	SyncJob *job = malloc(sizeof(SyncJob));
+	SyncChunk *chunk;
+	int i;
+
+	if (!job) {
+		perror("malloc SyncJob");
+		exit(EXIT_FAILURE);
+	}
+	job->count = count;
+	job->nchunks = size / SYNC_CHUNK;
+	if (job->nchunks < 1) {
+		job->nchunks = 1;
+	}
+	job->per = size / job->nchunks;
+	job->nslots = threads * SYNC_CHUNKS_PER_THREAD;
+	if ((uint64_t)job->nslots > job->nchunks) {
+		job->nslots = job->nchunks;
+	}
+	job->chunks = calloc(job->nslots, sizeof(SyncChunk));
+	if (!job->chunks) {
+		perror("malloc SyncChunk");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < job->nslots; i++) {
+		chunk = &job->chunks[i];
+		chunk->body = body;
+		chunk->size = size;
+		chunk->table = table;
+		chunk->count = count;
+		chunk->marks = malloc(SYNC_MARKS * sizeof(uint64_t));
+		if (!chunk->marks) {
+			perror("malloc");
+			exit(EXIT_FAILURE);
+		}
+		/* Bodies are about half the size of what they decode to */
+		chunk->out = makeMemWriter(2 * job->per);
+		chunk->task.arg = chunk;
+	}
+	job->pool = makePool(threads < job->nslots ? threads : job->nslots);
+	return job;
+}
+
+/* Starts a bit reader at any bit of the body */
+static void seekBits(BitReader *br, const SyncChunk *chunk, uint64_t bit) {
+	size_t byte = bit / 8 < chunk->size ? bit / 8 : chunk->size;
+	initBitReader(br, chunk->body + byte, chunk->size - byte);
+	refillBits(br);
+	br->acc <<= bit % 8;
+	br->nbits -= bit % 8;
+}
+
+/* Decodes one char. Works like streamSymbol in filerw.c, and also adds
+ * the bits the code took to pos. */
+static inline int syncSymbol(BitReader *br, const DecodeTable *table,
+		uint64_t *pos) {
+	int bits = table->bits;
+	const DecodeEntry *entry = table->entries;
+
+	while (1) {
+		if (br->nbits <= 64 - BYTE_SIZE) {
+			refillBits(br);
+		}
+		if (bits > 0) {
+			entry += br->acc >> (64 - bits);
+		}
+		if (!entry->link) {
+			break;
+		}
+		br->acc <<= bits;
+		br->nbits -= bits;
+		*pos += bits;
+		bits = entry->len;
+		entry = table->entries + entry->value;
+	}
+	br->acc <<= entry->len;
+	br->nbits -= entry->len;
+	*pos += entry->len;
+	return entry->value;
+}
+
+/* Decodes chars. from the chunk's end into its output until a code
+ * starts at or past stop or limit chars. have been decoded. When marked
+ * is set, the starts of the chunk's first SYNC_MARKS codes are kept. */
+static void decodeTo(SyncChunk *chunk, uint64_t stop, uint64_t limit,
+		int marked) {
+	BitReader br;
+	uint64_t pos = chunk->end;
+	uint64_t n;
+
+	seekBits(&br, chunk, pos);
+	for (n = 0; pos < stop && n < limit; n++) {
+		if (marked && chunk->nmarks < SYNC_MARKS) {
+			chunk->marks[chunk->nmarks++] = pos;
+		}
+		writerPutc(chunk->out, syncSymbol(&br, chunk->table, &pos));
+	}
+	chunk->end = pos;
+}
+
+/* Task function decoding one chunk from its start bit. Unless the chunk
+ * is the first, that bit is most likely in the middle of a code, so the
+ * first few chars. are garbage. A huffman code falls back into step
+ * after a few codes, though, and from then on the chars. are right. */
+static void speculateChunk(void *arg) {
+	SyncChunk *chunk = arg;
+	chunk->out->len = 0;
+	chunk->nmarks = 0;
+	chunk->end = chunk->start;
+	decodeTo(chunk, chunk->stop, chunk->count, 1);
+}
+
+/* Task function lining a chunk up with the next one. The chunk goes on
+ * decoding past its stop until one of its codes starts where one of the
+ * next chunk's marked codes does. From there both decode the same
+ * chars., so the chars. the next chunk decoded before that code are
+ * skipped. If the chunk gets past all of the next chunk's marks first,
+ * the next chunk is left unsynced and has to be decoded again. */
+static void resyncChunk(void *arg) {
+	SyncChunk *chunk = arg;
+	SyncChunk *next = chunk->next;
+	BitReader br;
+	uint64_t pos = chunk->end;
+	uint64_t n;
+	int k = 0;
+
+	seekBits(&br, chunk, pos);
+	next->synced = 0;
+	for (n = 0; n < chunk->count; n++) {
+		while (k < next->nmarks && next->marks[k] < pos) {
+			k++;
+		}
+		if (k == next->nmarks) {
+			break;
+		}
+		if (next->marks[k] == pos) {
+			next->skip = k;
+			next->synced = 1;
+			break;
+		}
+		writerPutc(chunk->out, syncSymbol(&br, chunk->table, &pos));
+	}
+	chunk->end = pos;
+}
+
+/* Runs a task function on the window's first n chunks and waits for
+ * them to finish */
+static void runChunks(SyncJob *job, void (*fn)(void *), int n) {
+	int i;
+	for (i = 0; i < n; i++) {
+		job->chunks[i].task.fn = fn;
+		poolSubmit(job->pool, &job->chunks[i].task);
+	}
+	for (i = 0; i < n; i++) {
+		poolWaitTask(job->pool, &job->chunks[i].task);
+	}
+}
+
+/* Decodes the job's body through a writer, a window of chunks at a
+ * time, with the chunks in a window decoded by the job's threads at
+ * once. Every chunk is first decoded from its start bit, and then each
+ * chunk decodes on into the next until the two line up. A chunk that
+ * the previous one never lined up with is decoded again from where the
+ * previous one stopped, one chunk after another. The chars. each chunk
+ * adds to the output are its chars. less the ones it skips, and the
+ * window is written chunk by chunk up to the body's count before the
+ * next window starts where its last chunk stopped. A code that runs
+ * past the end of the body is not used, so a body cut short comes up
+ * short of its count.
+ *
+ * Parameters:
+ *  job - A job over a body that is neither stored nor a run
+ *  out - The writer the chars. go to
+ *
+ * Returns 0 on success or -1 if the body ends before all of the chars.
+ * are decoded.
+ */
+int syncDecode(SyncJob *job, BufWriter *out) {
+	SyncChunk *chunk = job->chunks;
+	uint64_t written = 0;
+	uint64_t first = 0;
+	uint64_t pos = 0;
+	uint64_t g;
+	uint64_t n;
+	int nwindow;
+	int i;
+
+	while (first < job->nchunks && written < job->count) {
+		nwindow = job->nslots;
+		if ((uint64_t)nwindow > job->nchunks - first) {
+			nwindow = job->nchunks - first;
+		}
+		for (i = 0; i < nwindow; i++) {
+			chunk = &job->chunks[i];
+			g = first + i;
+			/* The window's first chunk starts on a code */
+			chunk->start = i == 0 ? pos : g * job->per * 8;
+			chunk->stop = g == job->nchunks - 1 ?
+				(uint64_t)chunk->size * 8 :
+				(g + 1) * job->per * 8;
+			chunk->next = i == nwindow - 1 ? NULL : chunk + 1;
+		}
+		runChunks(job, speculateChunk, nwindow);
+		runChunks(job, resyncChunk, nwindow - 1);
+		job->chunks[0].skip = 0;
+		job->chunks[0].synced = 1;
+		for (i = 1; i < nwindow; i++) {
+			chunk = &job->chunks[i];
+			if (chunk->synced) {
+				continue;
+			}
+			/* Where the previous chunk stopped is the start of a
+			 * code */
+			chunk->start = job->chunks[i - 1].end;
+			speculateChunk(chunk);
+			chunk->skip = 0;
+			chunk->synced = 1;
+			if (chunk->next) {
+				resyncChunk(chunk);
+			}
+		}
+
+		for (i = 0; i < nwindow && written < job->count; i++) {
+			chunk = &job->chunks[i];
+			n = chunk->out->len;
+			/* The last code decoded at the end of the body read
+			 * zeros past it */
+			if (chunk->end > (uint64_t)chunk->size * 8) {
+				n -= 1;
+			}
+			n = n > chunk->skip ? n - chunk->skip : 0;
+			if (n > job->count - written) {
+				n = job->count - written;
+			}
+			writerWrite(out, chunk->out->buf + chunk->skip, n);
+			written += n;
+		}
+		chunk = &job->chunks[nwindow - 1];
+		pos = chunk->end;
+		first += nwindow;
+	}
+	return written < job->count ? -1 : 0;
+}
+
+/* Frees the job and stops its threads. The body is left alone. */
+void syncJobDestroy(SyncJob *job) {
+	int i;
+	poolDestroy(job->pool);
+	for (i = 0; i < job->nslots; i++) {
+		free(job->chunks[i].marks);
+		writerDestroy(job->chunks[i].out);
+	}
+	free(job->chunks);
+	free(job);
+}
@@ -0,0 +1,72 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifndef SYNCH
+#define SYNCH
+#include "bufio.h"
+#include "dtable.h"
+#include "pool.h"
+
+/* Chunks decoded at a time per thread. Only this many chunks' output
+ * is held in memory, however large the body. */
+#define SYNC_CHUNKS_PER_THREAD 2
+/* Body bytes in a chunk */
+#define SYNC_CHUNK (1 << 20)
+/* Code starts remembered at the front of each chunk. The previous
+ * chunk has to line up with one of them; huffman codes nearly always
+ * line up within a few dozen codes. */
+#define SYNC_MARKS 4096
+
+/* SyncChunk: A range of a single body decoded by one task from a bit
+ * that need not be the start of a code */
+typedef struct SyncChunk {
+	Task task;
+	/* The whole body and its size in bytes */
+	const uint8_t *body;
+	size_t size;
+	const DecodeTable *table;
+	/* Number of chars. in the whole body. No chunk decodes more, so a
+	 * corrupt body can't keep a chunk going forever. */
+	uint64_t count;
+	/* Bit decoding started at */
+	uint64_t start;
+	/* Bit the next chunk starts at. Decoding goes on to the first code
+	 * that starts at or past it. */
+	uint64_t stop;
+	/* Bit just past the last code decoded */
+	uint64_t end;
+	/* Bits the first nmarks codes decoded start at */
+	uint64_t *marks;
+	int nmarks;
+	/* The decoded chars., including the codes decoded past stop until
+	 * the next chunk lined up */
+	BufWriter *out;
+	/* Leading chars. decoded before the previous chunk lined up with
+	 * this one, which are not part of the output */
+	uint64_t skip;
+	/* Set once the previous chunk has lined up with this one */
+	int synced;
+	/* The chunk after this one, NULL for the last in the window */
+	struct SyncChunk *next;
+} SyncChunk;
+
+/* SyncJob: One single body decoded by several threads at once, a
+ * window of chunks at a time */
+typedef struct SyncJob {
+	/* Number of chars. in the body */
+	uint64_t count;
+	/* Body bytes in every chunk but the last, and the number of
+	 * chunks the body is cut into */
+	size_t per;
+	uint64_t nchunks;
+	/* The window: chunks decoded at once, reused for every window */
+	SyncChunk *chunks;
+	int nslots;
+	ThreadPool *pool;
+} SyncJob;
+
+SyncJob *makeSyncJob(const uint8_t *, size_t, const DecodeTable *, uint64_t,
+		int);
+int syncDecode(SyncJob *, BufWriter *);
+void syncJobDestroy(SyncJob *);
+#endif